@@ -0,0 +1,180 @@
+#include <cstring>
+
+#include "binlog_event_filter.h"
+#include "crc32.h"
+#include "my_byteorder.h"
+
+
+static bool is_rows_event(uint8_t event_type) {
+  switch (event_type) {
+    case WRITE_ROWS_EVENT_V1:
+    case UPDATE_ROWS_EVENT_V1:
+    case DELETE_ROWS_EVENT_V1:
+    case WRITE_ROWS_EVENT_V2:
+    case UPDATE_ROWS_EVENT_V2:
+    case DELETE_ROWS_EVENT_V2:
+    case PARTIAL_UPDATE_ROWS_EVENT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static uint64_t read_table_id(const char* data) {
+  return uint6korr(data);
+}
+
+uint8_t verify_event_checksum(const char* packet, size_t size) {
+  if (size < BINLOG_PACKET_HEADER_SIZE + BINLOG_CHECKSUM_SIZE) {
+    return BINLOG_CHECKSUM_INVALID;
+  }
+  // the checksum covers the event header and body, but not the OK byte
+  const char* event = packet + 1;
+  size_t event_size = uint4korr(event + 9);
+  if (event_size < BINLOG_PACKET_HEADER_SIZE - 1 + BINLOG_CHECKSUM_SIZE || event_size > size - 1) {
+    return BINLOG_CHECKSUM_INVALID;
+  }
+  size_t data_size = event_size - BINLOG_CHECKSUM_SIZE;
+  uint32_t expected = uint4korr(event + data_size);
+  return crc32(event, data_size) == expected ? BINLOG_CHECKSUM_VALID : BINLOG_CHECKSUM_INVALID;
+}
+
+void BinlogEventFilter::set_verify_checksum(bool verify) {
+  verify_checksum = verify;
+}
+
+void BinlogEventFilter::allow_event_type(uint8_t event_type) {
+  allowed_event_types.set(event_type);
+}
+
+void BinlogEventFilter::allow_all_event_types() {
+  allowed_event_types.set();
+}
+
+void BinlogEventFilter::enable_only_schemas() {
+  has_only_schemas = true;
+}
+
+void BinlogEventFilter::enable_only_tables() {
+  has_only_tables = true;
+}
+
+void BinlogEventFilter::add_schema(const std::string& schema, bool ignored) {
+  if (ignored) {
+    ignored_schemas.insert(schema);
+    return;
+  }
+  enable_only_schemas();
+  only_schemas.insert(schema);
+}
+
+void BinlogEventFilter::add_table(const std::string& table, bool ignored) {
+  if (ignored) {
+    ignored_tables.insert(table);
+    return;
+  }
+  enable_only_tables();
+  only_tables.insert(table);
+}
+
+bool BinlogEventFilter::table_passes(const std::string& schema, const std::string& table) const {
+  if (has_only_tables && !only_tables.contains(table)) {
+    return false;
+  }
+  if (ignored_tables.contains(table)) {
+    return false;
+  }
+  if (has_only_schemas && !only_schemas.contains(schema)) {
+    return false;
+  }
+  if (ignored_schemas.contains(schema)) {
+    return false;
+  }
+  return true;
+}
+
+int BinlogEventFilter::check_table_map(const char* body, size_t size) {
+  // table_id(6) flags(2) schema_len(1) schema \0 table_len(1) table \0
+  size_t pos = BINLOG_TABLE_ID_SIZE + 2;
+  if (size < pos + 1) {
+    return BINLOG_EVENT_KEEP;
+  }
+  uint64_t table_id = read_table_id(body);
+  size_t schema_len = static_cast<uint8_t>(body[pos]);
+  pos += 1;
+  if (size < pos + schema_len + 2) {
+    return BINLOG_EVENT_KEEP;
+  }
+  std::string schema(body + pos, schema_len);
+  pos += schema_len + 1;
+  size_t table_len = static_cast<uint8_t>(body[pos]);
+  pos += 1;
+  if (size < pos + table_len) {
+    return BINLOG_EVENT_KEEP;
+  }
+  std::string table(body + pos, table_len);
+
+  bool passes = table_passes(schema, table);
+  table_ids[table_id] = passes;
+  return passes ? BINLOG_EVENT_KEEP : BINLOG_EVENT_SKIP;
+}
+
+int BinlogEventFilter::check_rows(const char* body, size_t size) const {
+  if (size < BINLOG_TABLE_ID_SIZE) {
+    return BINLOG_EVENT_KEEP;
+  }
+  auto it = table_ids.find(read_table_id(body));
+  if (it != table_ids.end() && !it->second) {
+    return BINLOG_EVENT_SKIP;
+  }
+  return BINLOG_EVENT_KEEP;
+}
+
+int BinlogEventFilter::check(const char* packet, size_t size, BinlogEventHeader* header) {
+  int result = check_event(packet, size, header);
+  if (result == BINLOG_EVENT_KEEP && verify_checksum) {
+    header->checksum_state = verify_event_checksum(packet, size);
+  }
+  return result;
+}
+
+int BinlogEventFilter::check_event(const char* packet, size_t size, BinlogEventHeader* header) {
+  if (size < BINLOG_PACKET_HEADER_SIZE) {
+    std::memset(header, 0, sizeof(BinlogEventHeader));
+    return BINLOG_EVENT_KEEP;
+  }
+  const char* data = packet + 1;
+  header->timestamp = uint4korr(data);
+  header->event_type = static_cast<uint8_t>(data[4]);
+  header->server_id = uint4korr(data + 5);
+  header->event_size = uint4korr(data + 9);
+  header->log_pos = uint4korr(data + 13);
+  header->flags = uint2korr(data + 17);
+  header->checksum_state = BINLOG_CHECKSUM_NOT_CHECKED;
+
+  const char* body = packet + BINLOG_PACKET_HEADER_SIZE;
+  size_t body_size = size - BINLOG_PACKET_HEADER_SIZE;
+
+  switch (header->event_type) {
+    case ROTATE_EVENT:
+      // same rule as the python table_map reset, see BinLogStreamReader.fetchone
+      if (header->timestamp != 0) {
+        table_ids.clear();
+      }
+      return BINLOG_EVENT_KEEP;
+    case FORMAT_DESCRIPTION_EVENT:
+      return BINLOG_EVENT_KEEP;
+    case TABLE_MAP_EVENT:
+      return check_table_map(body, body_size);
+    default:
+      break;
+  }
+
+  if (!allowed_event_types.test(header->event_type)) {
+    return BINLOG_EVENT_SKIP;
+  }
+  if (is_rows_event(header->event_type)) {
+    return check_rows(body, body_size);
+  }
+  return BINLOG_EVENT_KEEP;
+}
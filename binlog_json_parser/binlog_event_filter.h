@@ -0,0 +1,85 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+constexpr uint8_t ROTATE_EVENT = 0x04;
+constexpr uint8_t FORMAT_DESCRIPTION_EVENT = 0x0F;
+constexpr uint8_t TABLE_MAP_EVENT = 0x13;
+constexpr uint8_t WRITE_ROWS_EVENT_V1 = 0x17;
+constexpr uint8_t UPDATE_ROWS_EVENT_V1 = 0x18;
+constexpr uint8_t DELETE_ROWS_EVENT_V1 = 0x19;
+constexpr uint8_t WRITE_ROWS_EVENT_V2 = 0x1E;
+constexpr uint8_t UPDATE_ROWS_EVENT_V2 = 0x1F;
+constexpr uint8_t DELETE_ROWS_EVENT_V2 = 0x20;
+constexpr uint8_t PARTIAL_UPDATE_ROWS_EVENT = 0x27;
+
+// OK byte of the replication packet + v4 event header
+constexpr size_t BINLOG_PACKET_HEADER_SIZE = 20;
+constexpr size_t BINLOG_TABLE_ID_SIZE = 6;
+constexpr size_t BINLOG_CHECKSUM_SIZE = 4;
+
+constexpr int BINLOG_EVENT_SKIP = 0;
+constexpr int BINLOG_EVENT_KEEP = 1;
+
+constexpr uint8_t BINLOG_CHECKSUM_NOT_CHECKED = 0;
+constexpr uint8_t BINLOG_CHECKSUM_VALID = 1;
+constexpr uint8_t BINLOG_CHECKSUM_INVALID = 2;
+
+#pragma pack(push, 1)
+struct BinlogEventHeader {
+  uint32_t timestamp;
+  uint8_t event_type;
+  uint32_t server_id;
+  uint32_t event_size;
+  uint32_t log_pos;
+  uint16_t flags;
+  // not part of the binlog header, filled when checksum verification is on
+  uint8_t checksum_state;
+};
+#pragma pack(pop)
+
+// Checks the CRC32 footer of the event in a replication packet.
+// Returns BINLOG_CHECKSUM_VALID or BINLOG_CHECKSUM_INVALID.
+uint8_t verify_event_checksum(const char* packet, size_t size);
+
+// Decides from the raw replication packet whether an event has to be decoded
+// at all. Mirrors the only_*/ignored_* filters of BinLogStreamReader and keeps
+// its own table_id => "passes filters" map built from TABLE_MAP events, so
+// rows of filtered tables are dropped without touching python.
+class BinlogEventFilter {
+public:
+  void set_verify_checksum(bool verify);
+  void allow_event_type(uint8_t event_type);
+  void allow_all_event_types();
+  // only_* filters are active once enabled, even if no names are added
+  void enable_only_schemas();
+  void enable_only_tables();
+  void add_schema(const std::string& schema, bool ignored);
+  void add_table(const std::string& table, bool ignored);
+
+  // Parses the header into `header` and returns BINLOG_EVENT_KEEP or
+  // BINLOG_EVENT_SKIP. Malformed packets are always kept so that the
+  // python decoder reports them. Checksums are verified for kept events only.
+  int check(const char* packet, size_t size, BinlogEventHeader* header);
+
+private:
+  int check_event(const char* packet, size_t size, BinlogEventHeader* header);
+  bool table_passes(const std::string& schema, const std::string& table) const;
+  int check_table_map(const char* body, size_t size);
+  int check_rows(const char* body, size_t size) const;
+
+  bool verify_checksum = false;
+  std::bitset<256> allowed_event_types;
+  bool has_only_schemas = false;
+  bool has_only_tables = false;
+  std::unordered_set<std::string> only_schemas;
+  std::unordered_set<std::string> ignored_schemas;
+  std::unordered_set<std::string> only_tables;
+  std::unordered_set<std::string> ignored_tables;
+  std::unordered_map<uint64_t, bool> table_ids;
+};
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binlog_file_reader.h"
+#include "binlog_event_filter.h"
+#include "my_byteorder.h"
+
+
+constexpr char BINLOG_MAGIC[] = "\xfe" "bin";
+constexpr uint8_t BINLOG_CHECKSUM_ALG_CRC32 = 1;
+
+BinlogFileReader::BinlogFileReader(const std::string& path) {
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open " + path + ": " + std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to stat " + path + ": " + std::strerror(errno));
+  }
+  file_size = st.st_size;
+  if (file_size < BINLOG_MAGIC_SIZE) {
+    close(fd);
+    throw std::runtime_error("binlog file is too small: " + path);
+  }
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapped == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("failed to mmap " + path + ": " + std::strerror(errno));
+  }
+  mapping = static_cast<char*>(mapped);
+  madvise(mapping, file_size, MADV_SEQUENTIAL);
+  if (std::memcmp(mapping, BINLOG_MAGIC, BINLOG_MAGIC_SIZE) != 0) {
+    munmap(mapping, file_size);
+    close(fd);
+    throw std::runtime_error("bad binlog magic bytes: " + path);
+  }
+}
+
+BinlogFileReader::~BinlogFileReader() {
+  if (mapping) {
+    munmap(mapping, file_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void BinlogFileReader::read_format_description(const char* event, uint32_t size) {
+  // the checksum algorithm byte is followed by the 4 byte checksum itself,
+  // binlogs written before 5.6.1 have neither
+  constexpr size_t FORMAT_DESCRIPTION_MIN_SIZE = BINLOG_EVENT_HEADER_SIZE + 2 + 50 + 4 + 1;
+  if (size < FORMAT_DESCRIPTION_MIN_SIZE + 1 + BINLOG_CHECKSUM_SIZE) {
+    has_checksum = false;
+    return;
+  }
+  uint8_t algorithm = static_cast<uint8_t>(event[size - BINLOG_CHECKSUM_SIZE - 1]);
+  has_checksum = algorithm == BINLOG_CHECKSUM_ALG_CRC32;
+}
+
+bool BinlogFileReader::next(uint64_t* offset, uint32_t* size) {
+  if (current_position + BINLOG_EVENT_HEADER_SIZE > file_size) {
+    return false;
+  }
+  const char* event = mapping + current_position;
+  uint32_t event_size = uint4korr(event + 9);
+  if (event_size < BINLOG_EVENT_HEADER_SIZE || current_position + event_size > file_size) {
+    return false;
+  }
+  if (static_cast<uint8_t>(event[4]) == FORMAT_DESCRIPTION_EVENT) {
+    read_format_description(event, event_size);
+  }
+  *offset = current_position;
+  *size = event_size;
+  current_position += event_size;
+  return true;
+}
+
+void BinlogFileReader::seek(uint64_t position) {
+  // the format description event always comes first, the checksum
+  // setting has to be known even if we start in the middle of the file
+  current_position = BINLOG_MAGIC_SIZE;
+  uint64_t offset;
+  uint32_t size;
+  if (position > BINLOG_MAGIC_SIZE) {
+    next(&offset, &size);
+  }
+  current_position = std::max(position, static_cast<uint64_t>(BINLOG_MAGIC_SIZE));
+}
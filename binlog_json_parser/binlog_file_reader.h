@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+constexpr size_t BINLOG_MAGIC_SIZE = 4;
+constexpr size_t BINLOG_EVENT_HEADER_SIZE = 19;
+
+// Sequential reader over a MySQL binlog file mapped into memory.
+// Events are returned as (offset, size) into the mapping, a partially
+// written trailing event is treated as the end of the file.
+class BinlogFileReader {
+public:
+  explicit BinlogFileReader(const std::string& path);
+  ~BinlogFileReader();
+
+  BinlogFileReader(const BinlogFileReader&) = delete;
+  BinlogFileReader& operator=(const BinlogFileReader&) = delete;
+
+  bool next(uint64_t* offset, uint32_t* size);
+  void seek(uint64_t position);
+  const char* data() const { return mapping; }
+  uint64_t size() const { return file_size; }
+  uint64_t position() const { return current_position; }
+  bool checksum_enabled() const { return has_checksum; }
+
+private:
+  void read_format_description(const char* event, uint32_t size);
+
+  int fd = -1;
+  char* mapping = nullptr;
+  uint64_t file_size = 0;
+  uint64_t current_position = BINLOG_MAGIC_SIZE;
+  bool has_checksum = false;
+};
@@ -0,0 +1,122 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "block_compression.h"
+
+
+// fast levels, the blocks are written on the replication path
+constexpr int ZSTD_LEVEL = 1;
+constexpr int ZLIB_LEVEL = 1;
+
+bool block_codec_available(uint8_t codec) {
+  switch (codec) {
+    case BLOCK_CODEC_NONE:
+    case BLOCK_CODEC_ZLIB:
+      return true;
+#ifdef HAVE_LZ4
+    case BLOCK_CODEC_LZ4:
+      return true;
+#endif
+#ifdef HAVE_ZSTD
+    case BLOCK_CODEC_ZSTD:
+      return true;
+#endif
+  }
+  return false;
+}
+
+void compress_block(uint8_t codec, const char* data, size_t size, std::string& out) {
+  switch (codec) {
+    case BLOCK_CODEC_NONE:
+      out.assign(data, size);
+      return;
+
+#ifdef HAVE_LZ4
+    case BLOCK_CODEC_LZ4: {
+      out.resize(LZ4_compressBound(static_cast<int>(size)));
+      int compressed = LZ4_compress_default(data, out.data(), static_cast<int>(size),
+                                            static_cast<int>(out.size()));
+      if (compressed <= 0) {
+        throw std::runtime_error("lz4 compression failed");
+      }
+      out.resize(compressed);
+      return;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case BLOCK_CODEC_ZSTD: {
+      out.resize(ZSTD_compressBound(size));
+      size_t compressed = ZSTD_compress(out.data(), out.size(), data, size, ZSTD_LEVEL);
+      if (ZSTD_isError(compressed)) {
+        throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(compressed));
+      }
+      out.resize(compressed);
+      return;
+    }
+#endif
+
+    case BLOCK_CODEC_ZLIB: {
+      uLongf compressed = compressBound(size);
+      out.resize(compressed);
+      int result = compress2(reinterpret_cast<Bytef*>(out.data()), &compressed,
+                             reinterpret_cast<const Bytef*>(data), size, ZLIB_LEVEL);
+      if (result != Z_OK) {
+        throw std::runtime_error("zlib compression failed: " + std::to_string(result));
+      }
+      out.resize(compressed);
+      return;
+    }
+  }
+  throw std::runtime_error("compression codec " + std::to_string(codec) + " is not available");
+}
+
+void decompress_block(uint8_t codec, const char* data, size_t size, char* out, size_t out_size) {
+  switch (codec) {
+    case BLOCK_CODEC_NONE:
+      if (size != out_size) {
+        throw std::runtime_error("bad uncompressed block size");
+      }
+      std::memcpy(out, data, size);
+      return;
+
+#ifdef HAVE_LZ4
+    case BLOCK_CODEC_LZ4: {
+      int result = LZ4_decompress_safe(data, out, static_cast<int>(size), static_cast<int>(out_size));
+      if (result < 0 || static_cast<size_t>(result) != out_size) {
+        throw std::runtime_error("lz4 decompression failed");
+      }
+      return;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case BLOCK_CODEC_ZSTD: {
+      size_t result = ZSTD_decompress(out, out_size, data, size);
+      if (ZSTD_isError(result) || result != out_size) {
+        throw std::runtime_error("zstd decompression failed");
+      }
+      return;
+    }
+#endif
+
+    case BLOCK_CODEC_ZLIB: {
+      uLongf result_size = out_size;
+      int result = uncompress(reinterpret_cast<Bytef*>(out), &result_size,
+                              reinterpret_cast<const Bytef*>(data), size);
+      if (result != Z_OK || result_size != out_size) {
+        throw std::runtime_error("zlib decompression failed: " + std::to_string(result));
+      }
+      return;
+    }
+  }
+  throw std::runtime_error("compression codec " + std::to_string(codec) + " is not available");
+}
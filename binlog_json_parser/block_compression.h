@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Codecs of event log blocks. LZ4 and ZSTD are compiled in when their
+// headers are found (HAVE_LZ4 / HAVE_ZSTD), zlib is always available.
+constexpr uint8_t BLOCK_CODEC_NONE = 0;
+constexpr uint8_t BLOCK_CODEC_LZ4 = 1;
+constexpr uint8_t BLOCK_CODEC_ZSTD = 2;
+constexpr uint8_t BLOCK_CODEC_ZLIB = 3;
+
+bool block_codec_available(uint8_t codec);
+
+// Replaces `out` with the compressed data. Throws std::runtime_error.
+void compress_block(uint8_t codec, const char* data, size_t size, std::string& out);
+
+// `out` must have room for exactly the uncompressed size. Throws std::runtime_error.
+void decompress_block(uint8_t codec, const char* data, size_t size, char* out, size_t out_size);
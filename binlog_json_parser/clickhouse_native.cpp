@@ -0,0 +1,515 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "clickhouse_native.h"
+#include <datetime.h>
+
+#include "civil_date.h"
+
+
+constexpr int64_t SECONDS_PER_DAY = 86400;
+constexpr int64_t MICROSECONDS_PER_SECOND = 1000000;
+constexpr int DATETIME64_MAX_PRECISION = 9;
+constexpr int64_t MAX_FOLD_SECONDS = 24 * 3600;
+
+enum class ColumnKind {
+  INT8, INT16, INT32, INT64,
+  UINT8, UINT16, UINT32, UINT64,
+  FLOAT32, FLOAT64, BOOL, STRING,
+  DATE, DATE32, DATETIME, DATETIME64,
+};
+
+struct ColumnType {
+  ColumnKind kind;
+  bool nullable = false;
+  int precision = 0;  // DateTime64
+};
+
+static bool parse_column_type(std::string_view type, ColumnType& result) {
+  constexpr std::string_view NULLABLE = "Nullable(";
+  result.nullable = false;
+  if (type.starts_with(NULLABLE) && type.ends_with(")")) {
+    result.nullable = true;
+    type = type.substr(NULLABLE.size(), type.size() - NULLABLE.size() - 1);
+  }
+
+  static constexpr std::pair<std::string_view, ColumnKind> SIMPLE_TYPES[] = {
+    {"Int8", ColumnKind::INT8}, {"Int16", ColumnKind::INT16},
+    {"Int32", ColumnKind::INT32}, {"Int64", ColumnKind::INT64},
+    {"UInt8", ColumnKind::UINT8}, {"UInt16", ColumnKind::UINT16},
+    {"UInt32", ColumnKind::UINT32}, {"UInt64", ColumnKind::UINT64},
+    {"Float32", ColumnKind::FLOAT32}, {"Float64", ColumnKind::FLOAT64},
+    {"Bool", ColumnKind::BOOL}, {"String", ColumnKind::STRING},
+    {"Date", ColumnKind::DATE}, {"Date32", ColumnKind::DATE32},
+    {"DateTime", ColumnKind::DATETIME},
+  };
+  for (const auto& [name, kind] : SIMPLE_TYPES) {
+    if (type == name) {
+      result.kind = kind;
+      return true;
+    }
+  }
+
+  // the timezone of a column only affects how values are shown
+  if (type.starts_with("DateTime('") && type.ends_with("')")) {
+    result.kind = ColumnKind::DATETIME;
+    return true;
+  }
+  constexpr std::string_view DATETIME64 = "DateTime64(";
+  if (type.starts_with(DATETIME64) && type.ends_with(")") && type.size() > DATETIME64.size() + 1) {
+    char digit = type[DATETIME64.size()];
+    char next = type[DATETIME64.size() + 1];
+    if (digit < '0' || digit > '0' + DATETIME64_MAX_PRECISION || (next != ')' && next != ',')) {
+      return false;
+    }
+    result.kind = ColumnKind::DATETIME64;
+    result.precision = digit - '0';
+    return true;
+  }
+  return false;
+}
+
+static void append_varuint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+static void append_string(std::string& out, const char* data, size_t size) {
+  append_varuint(out, size);
+  out.append(data, size);
+}
+
+template <typename T>
+static void append_fixed(std::string& out, T value) {
+  // ClickHouse and every platform this is built for are little endian
+  char buffer[sizeof(T)];
+  std::memcpy(buffer, &value, sizeof(T));
+  out.append(buffer, sizeof(T));
+}
+
+static void set_column_error(PyObject* type, const char* message, PyObject* column_name) {
+  PyErr_Format(type, "%s for column %U", message, column_name);
+}
+
+template <typename T>
+static bool append_integer(std::string& out, PyObject* value, PyObject* column_name) {
+  if (!PyLong_Check(value)) {
+    set_column_error(PyExc_TypeError, "an int is expected", column_name);
+    return false;
+  }
+  if constexpr (std::is_signed_v<T>) {
+    int overflow = 0;
+    long long number = PyLong_AsLongLongAndOverflow(value, &overflow);
+    if (overflow || number < std::numeric_limits<T>::min() || number > std::numeric_limits<T>::max()) {
+      set_column_error(PyExc_OverflowError, "value out of range", column_name);
+      return false;
+    }
+    append_fixed(out, static_cast<T>(number));
+  } else {
+    unsigned long long number = PyLong_AsUnsignedLongLong(value);
+    if ((number == static_cast<unsigned long long>(-1) && PyErr_Occurred()) ||
+        number > std::numeric_limits<T>::max()) {
+      PyErr_Clear();
+      set_column_error(PyExc_OverflowError, "value out of range", column_name);
+      return false;
+    }
+    append_fixed(out, static_cast<T>(number));
+  }
+  return true;
+}
+
+// UTC offsets of the local timezone, cached for one encode call (the
+// timezone can change between calls) by quarter of an hour: an offset that
+// is the same at both ends of a quarter is taken for all of it, wrong only
+// if it changed twice within the quarter. Quarters with a change are
+// looked up second by second.
+class LocalTimeOffsets {
+public:
+  // The local time at `seconds` since the epoch, as seconds since the
+  // epoch of that time taken as UTC.
+  bool local_seconds(int64_t seconds, int64_t* result) {
+    int64_t quarter = floor_div(seconds, QUARTER_SECONDS);
+    Entry& entry = entries[static_cast<uint64_t>(quarter) % entries.size()];
+    if (entry.quarter != quarter || !entry.valid) {
+      int64_t last_offset = 0;
+      if (!lookup_offset(quarter * QUARTER_SECONDS, &entry.offset) ||
+          !lookup_offset(quarter * QUARTER_SECONDS + QUARTER_SECONDS - 1, &last_offset)) {
+        return false;
+      }
+      entry.quarter = quarter;
+      entry.valid = true;
+      entry.constant = entry.offset == last_offset;
+    }
+    int64_t offset = entry.offset;
+    if (!entry.constant && !lookup_offset(seconds, &offset)) {
+      return false;
+    }
+    *result = seconds + offset;
+    return true;
+  }
+
+private:
+  static constexpr int64_t QUARTER_SECONDS = 900;
+
+  struct Entry {
+    int64_t quarter = 0;
+    int64_t offset = 0;
+    bool valid = false;
+    bool constant = false;
+  };
+
+  static bool lookup_offset(int64_t seconds, int64_t* offset) {
+    time_t time = static_cast<time_t>(seconds);
+    struct tm local_time;
+    if (time != seconds || localtime_r(&time, &local_time) == nullptr) {
+      return false;
+    }
+    int64_t days = days_from_civil(local_time.tm_year + 1900, local_time.tm_mon + 1, local_time.tm_mday);
+    *offset = days * SECONDS_PER_DAY + local_time.tm_hour * 3600 + local_time.tm_min * 60 + local_time.tm_sec -
+              seconds;
+    return true;
+  }
+
+  std::array<Entry, 256> entries;
+};
+
+// Seconds since the epoch of the local time `local` (seconds since the
+// epoch if it was UTC), solved the way python's datetime.timestamp() does
+// for naive datetimes: `fold` picks the earlier or later of a time repeated
+// when the clocks go back, a time skipped when they go forward is shifted.
+static bool local_to_seconds(LocalTimeOffsets& offsets, int64_t local, bool fold, int64_t* seconds) {
+  int64_t lt = 0;
+  if (!offsets.local_seconds(local, &lt)) {
+    return false;
+  }
+  int64_t a = lt - local;
+  int64_t u1 = local - a;
+  int64_t t1 = 0;
+  if (!offsets.local_seconds(u1, &t1)) {
+    return false;
+  }
+  int64_t b = 0;
+  if (t1 == local) {
+    // one solution, look for an earlier (fold 0) or later (fold 1) one
+    int64_t u2 = fold ? u1 + MAX_FOLD_SECONDS : u1 - MAX_FOLD_SECONDS;
+    if (!offsets.local_seconds(u2, &lt)) {
+      return false;
+    }
+    b = lt - u2;
+    if (a == b) {
+      *seconds = u1;
+      return true;
+    }
+  } else {
+    b = t1 - u1;
+  }
+  int64_t u2 = local - b;
+  int64_t t2 = 0;
+  if (!offsets.local_seconds(u2, &t2)) {
+    return false;
+  }
+  if (t2 == local) {
+    *seconds = u2;
+  } else if (t1 == local) {
+    *seconds = u1;
+  } else {
+    // in a gap
+    *seconds = fold ? std::min(u1, u2) : std::max(u1, u2);
+  }
+  return true;
+}
+
+// Microseconds since 1970-01-01 UTC. Naive datetimes are local time, like
+// clickhouse_connect takes them (through datetime.timestamp()).
+static bool datetime_microseconds(LocalTimeOffsets& offsets, PyObject* value, PyObject* column_name,
+                                  int64_t* microseconds) {
+  if (!PyDateTime_Check(value)) {
+    set_column_error(PyExc_TypeError, "a datetime is expected", column_name);
+    return false;
+  }
+  int64_t days = days_from_civil(PyDateTime_GET_YEAR(value), PyDateTime_GET_MONTH(value), PyDateTime_GET_DAY(value));
+  int64_t seconds = days * SECONDS_PER_DAY + PyDateTime_DATE_GET_HOUR(value) * 3600 +
+                    PyDateTime_DATE_GET_MINUTE(value) * 60 + PyDateTime_DATE_GET_SECOND(value);
+  if (PyDateTime_DATE_GET_TZINFO(value) == Py_None &&
+      !local_to_seconds(offsets, seconds, PyDateTime_DATE_GET_FOLD(value), &seconds)) {
+    set_column_error(PyExc_OverflowError, "datetime out of range", column_name);
+    return false;
+  }
+  *microseconds = seconds * MICROSECONDS_PER_SECOND + PyDateTime_DATE_GET_MICROSECOND(value);
+  if (PyDateTime_DATE_GET_TZINFO(value) != Py_None) {
+    PyObject* offset = PyObject_CallMethod(value, "utcoffset", nullptr);
+    if (offset == nullptr) {
+      return false;
+    }
+    if (offset != Py_None) {
+      *microseconds -= (PyDateTime_DELTA_GET_DAYS(offset) * SECONDS_PER_DAY + PyDateTime_DELTA_GET_SECONDS(offset)) *
+                       MICROSECONDS_PER_SECOND + PyDateTime_DELTA_GET_MICROSECONDS(offset);
+    }
+    Py_DECREF(offset);
+  }
+  return true;
+}
+
+// Appends the value for a row, None (in a Nullable column) as the default
+// value of the type.
+static bool append_value(std::string& out, const ColumnType& type, PyObject* value, PyObject* column_name,
+                         LocalTimeOffsets& offsets) {
+  bool is_null = value == Py_None;
+  switch (type.kind) {
+    case ColumnKind::INT8:
+      return is_null ? (append_fixed<int8_t>(out, 0), true) : append_integer<int8_t>(out, value, column_name);
+    case ColumnKind::INT16:
+      return is_null ? (append_fixed<int16_t>(out, 0), true) : append_integer<int16_t>(out, value, column_name);
+    case ColumnKind::INT32:
+      return is_null ? (append_fixed<int32_t>(out, 0), true) : append_integer<int32_t>(out, value, column_name);
+    case ColumnKind::INT64:
+      return is_null ? (append_fixed<int64_t>(out, 0), true) : append_integer<int64_t>(out, value, column_name);
+    case ColumnKind::UINT8:
+      return is_null ? (append_fixed<uint8_t>(out, 0), true) : append_integer<uint8_t>(out, value, column_name);
+    case ColumnKind::UINT16:
+      return is_null ? (append_fixed<uint16_t>(out, 0), true) : append_integer<uint16_t>(out, value, column_name);
+    case ColumnKind::UINT32:
+      return is_null ? (append_fixed<uint32_t>(out, 0), true) : append_integer<uint32_t>(out, value, column_name);
+    case ColumnKind::UINT64:
+      return is_null ? (append_fixed<uint64_t>(out, 0), true) : append_integer<uint64_t>(out, value, column_name);
+
+    case ColumnKind::FLOAT32:
+    case ColumnKind::FLOAT64: {
+      double number = 0;
+      if (!is_null) {
+        // ints and decimals as well
+        number = PyFloat_AsDouble(value);
+        if (number == -1.0 && PyErr_Occurred()) {
+          PyErr_Clear();
+          set_column_error(PyExc_TypeError, "a number is expected", column_name);
+          return false;
+        }
+      }
+      if (type.kind == ColumnKind::FLOAT32) {
+        append_fixed(out, static_cast<float>(number));
+      } else {
+        append_fixed(out, number);
+      }
+      return true;
+    }
+
+    case ColumnKind::BOOL: {
+      int truth = is_null ? 0 : PyObject_IsTrue(value);
+      if (truth < 0) {
+        return false;
+      }
+      append_fixed<uint8_t>(out, truth);
+      return true;
+    }
+
+    case ColumnKind::STRING: {
+      if (is_null) {
+        append_varuint(out, 0);
+      } else if (PyUnicode_Check(value)) {
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize(value, &size);
+        if (data == nullptr) {
+          return false;
+        }
+        append_string(out, data, size);
+      } else if (PyBytes_Check(value)) {
+        append_string(out, PyBytes_AS_STRING(value), PyBytes_GET_SIZE(value));
+      } else {
+        set_column_error(PyExc_TypeError, "str or bytes are expected", column_name);
+        return false;
+      }
+      return true;
+    }
+
+    case ColumnKind::DATE:
+    case ColumnKind::DATE32: {
+      int64_t days = 0;
+      if (!is_null) {
+        if (!PyDate_Check(value)) {
+          set_column_error(PyExc_TypeError, "a date is expected", column_name);
+          return false;
+        }
+        days = days_from_civil(PyDateTime_GET_YEAR(value), PyDateTime_GET_MONTH(value), PyDateTime_GET_DAY(value));
+      }
+      if (type.kind == ColumnKind::DATE) {
+        if (days < 0 || days > std::numeric_limits<uint16_t>::max()) {
+          set_column_error(PyExc_OverflowError, "date out of range", column_name);
+          return false;
+        }
+        append_fixed(out, static_cast<uint16_t>(days));
+      } else {
+        append_fixed(out, static_cast<int32_t>(days));
+      }
+      return true;
+    }
+
+    case ColumnKind::DATETIME: {
+      int64_t microseconds = 0;
+      if (!is_null && !datetime_microseconds(offsets, value, column_name, &microseconds)) {
+        return false;
+      }
+      int64_t seconds = floor_div(microseconds, MICROSECONDS_PER_SECOND);
+      if (seconds < 0 || seconds > std::numeric_limits<uint32_t>::max()) {
+        set_column_error(PyExc_OverflowError, "datetime out of range", column_name);
+        return false;
+      }
+      append_fixed(out, static_cast<uint32_t>(seconds));
+      return true;
+    }
+
+    case ColumnKind::DATETIME64: {
+      int64_t microseconds = 0;
+      if (!is_null && !datetime_microseconds(offsets, value, column_name, &microseconds)) {
+        return false;
+      }
+      int64_t ticks = microseconds;
+      for (int precision = type.precision; precision < 6; precision++) {
+        ticks = floor_div(ticks, 10);
+      }
+      for (int precision = 6; precision < type.precision; precision++) {
+        if (ticks > INT64_MAX / 10 || ticks < INT64_MIN / 10) {
+          set_column_error(PyExc_OverflowError, "datetime out of range", column_name);
+          return false;
+        }
+        ticks *= 10;
+      }
+      append_fixed(out, ticks);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool clickhouse_native_type_supported(const char* type) {
+  ColumnType column_type;
+  return parse_column_type(type, column_type);
+}
+
+PyObject* encode_clickhouse_native(PyObject* records, PyObject* column_names, PyObject* column_types,
+                                   PyObject* versions) {
+  if (PyDateTimeAPI == nullptr) {
+    PyDateTime_IMPORT;
+    if (PyDateTimeAPI == nullptr) {
+      return nullptr;
+    }
+  }
+  unsigned long long version = 0;
+  if (!PyBytes_Check(versions)) {
+    version = PyLong_AsUnsignedLongLong(versions);
+    if (version == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+      return nullptr;
+    }
+  }
+
+  PyObject* names = PySequence_Fast(column_names, "column names must be a sequence");
+  PyObject* types = names ? PySequence_Fast(column_types, "column types must be a sequence") : nullptr;
+  PyObject* rows = types ? PySequence_Fast(records, "records must be iterable") : nullptr;
+  std::vector<PyObject*> row_values;
+  PyObject* result = nullptr;
+
+  auto encode = [&]() -> PyObject* {
+    Py_ssize_t column_count = PySequence_Fast_GET_SIZE(names);
+    if (PySequence_Fast_GET_SIZE(types) != column_count) {
+      PyErr_SetString(PyExc_ValueError, "column names and types differ in length");
+      return nullptr;
+    }
+    std::vector<ColumnType> parsed_types(column_count);
+    for (Py_ssize_t column = 0; column < column_count; column++) {
+      const char* type = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(types, column));
+      if (type == nullptr) {
+        return nullptr;
+      }
+      if (!parse_column_type(type, parsed_types[column])) {
+        PyErr_Format(PyExc_ValueError, "unsupported column type %s", type);
+        return nullptr;
+      }
+    }
+
+    Py_ssize_t row_count = PySequence_Fast_GET_SIZE(rows);
+    if (PyBytes_Check(versions) && PyBytes_GET_SIZE(versions) != row_count * static_cast<Py_ssize_t>(sizeof(uint64_t))) {
+      PyErr_SetString(PyExc_ValueError, "versions differ in number from the records");
+      return nullptr;
+    }
+    row_values.reserve(row_count);
+    for (Py_ssize_t row = 0; row < row_count; row++) {
+      PyObject* values = PySequence_Fast(PySequence_Fast_GET_ITEM(rows, row), "a record must be a sequence");
+      if (values == nullptr) {
+        return nullptr;
+      }
+      row_values.push_back(values);
+      if (PySequence_Fast_GET_SIZE(values) != column_count) {
+        PyErr_SetString(PyExc_ValueError, "record size differs from the number of columns");
+        return nullptr;
+      }
+    }
+
+    std::string out;
+    out.reserve((column_count + 1) * row_count * 8 + 64);
+    append_varuint(out, column_count + 1);
+    append_varuint(out, row_count);
+    LocalTimeOffsets offsets;
+    for (Py_ssize_t column = 0; column < column_count; column++) {
+      PyObject* name = PySequence_Fast_GET_ITEM(names, column);
+      Py_ssize_t size;
+      const char* data = PyUnicode_AsUTF8AndSize(name, &size);
+      if (data == nullptr) {
+        return nullptr;
+      }
+      append_string(out, data, size);
+      data = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(types, column), &size);
+      append_string(out, data, size);
+
+      const ColumnType& type = parsed_types[column];
+      if (type.nullable) {
+        for (PyObject* values : row_values) {
+          out.push_back(PySequence_Fast_GET_ITEM(values, column) == Py_None ? 1 : 0);
+        }
+      }
+      for (PyObject* values : row_values) {
+        PyObject* value = PySequence_Fast_GET_ITEM(values, column);
+        if (value == Py_None && !type.nullable) {
+          set_column_error(PyExc_TypeError, "NULL in a non Nullable column", name);
+          return nullptr;
+        }
+        if (!append_value(out, type, value, name, offsets)) {
+          return nullptr;
+        }
+      }
+    }
+
+    constexpr std::string_view VERSION_NAME = "_version";
+    constexpr std::string_view VERSION_TYPE = "UInt64";
+    append_string(out, VERSION_NAME.data(), VERSION_NAME.size());
+    append_string(out, VERSION_TYPE.data(), VERSION_TYPE.size());
+    if (PyBytes_Check(versions)) {
+      // already the column data
+      out.append(PyBytes_AS_STRING(versions), PyBytes_GET_SIZE(versions));
+    } else {
+      for (Py_ssize_t row = 0; row < row_count; row++) {
+        append_fixed<uint64_t>(out, version + row);
+      }
+    }
+    return PyBytes_FromStringAndSize(out.data(), out.size());
+  };
+
+  if (rows != nullptr) {
+    result = encode();
+  }
+  for (PyObject* values : row_values) {
+    Py_DECREF(values);
+  }
+  Py_XDECREF(rows);
+  Py_XDECREF(types);
+  Py_XDECREF(names);
+  return result;
+}
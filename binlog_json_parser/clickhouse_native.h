@@ -0,0 +1,24 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// Rows for ClickHouse inserts in the Native format (INSERT ... FORMAT
+// Native): one block with a column per name/type, values serialized
+// column by column, plus the UInt64 `_version` column. `versions` is
+// either an int, the rows are then numbered from it, or bytes with the
+// version of every row (native uint64).
+//
+// Supported column types: Int8..Int64, UInt8..UInt64, Float32, Float64,
+// Bool, String, Date, Date32, DateTime, DateTime64(p[, tz]) and Nullable
+// of those. Naive datetimes are taken as local time (like python's
+// datetime.timestamp() and so clickhouse_connect), aware ones are converted.
+// Values of an unexpected python type raise TypeError, values out of the
+// range of the column OverflowError.
+//
+// Runs with the GIL held (ctypes.PyDLL), returns bytes or nullptr with a
+// python exception set.
+PyObject* encode_clickhouse_native(PyObject* records, PyObject* column_names, PyObject* column_types,
+                                   PyObject* versions);
+
+bool clickhouse_native_type_supported(const char* type);
@@ -0,0 +1,172 @@
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "crc32.h"
+
+
+constexpr uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
+constexpr size_t CRC32_SLICES = 8;
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, CRC32_SLICES>;
+
+static constexpr Crc32Tables make_crc32_tables() {
+  Crc32Tables tables{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+    }
+    tables[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (size_t slice = 1; slice < CRC32_SLICES; slice++) {
+      uint32_t prev = tables[slice - 1][i];
+      tables[slice][i] = (prev >> 8) ^ tables[0][prev & 0xFF];
+    }
+  }
+  return tables;
+}
+
+static constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+
+// Slice-by-8: eight table lookups per 8 input bytes instead of one per byte.
+// Works on the inverted crc state.
+static uint32_t crc32_slice_by_8(uint32_t crc, const uint8_t* bytes, size_t len) {
+  while (len >= 8) {
+    uint32_t low;
+    uint32_t high;
+    std::memcpy(&low, bytes, 4);
+    std::memcpy(&high, bytes + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    low = __builtin_bswap32(low);
+    high = __builtin_bswap32(high);
+#endif
+    low ^= crc;
+    crc = CRC32_TABLES[7][low & 0xFF] ^
+          CRC32_TABLES[6][(low >> 8) & 0xFF] ^
+          CRC32_TABLES[5][(low >> 16) & 0xFF] ^
+          CRC32_TABLES[4][low >> 24] ^
+          CRC32_TABLES[3][high & 0xFF] ^
+          CRC32_TABLES[2][(high >> 8) & 0xFF] ^
+          CRC32_TABLES[1][(high >> 16) & 0xFF] ^
+          CRC32_TABLES[0][high >> 24];
+    bytes += 8;
+    len -= 8;
+  }
+  while (len--) {
+    crc = (crc >> 8) ^ CRC32_TABLES[0][(crc ^ *bytes++) & 0xFF];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+constexpr size_t CRC32_PCLMUL_MIN_SIZE = 64;
+
+alignas(16) static const uint64_t CRC32_K1K2[] = {0x0154442bd4, 0x01c6e41596};
+alignas(16) static const uint64_t CRC32_K3K4[] = {0x01751997d0, 0x00ccaa009e};
+alignas(16) static const uint64_t CRC32_K5K0[] = {0x0163cd6124, 0x0000000000};
+alignas(16) static const uint64_t CRC32_POLY[] = {0x01db710641, 0x01f7011641};
+
+// Carry-less multiplication folding ("Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction", Intel), 64 bytes per iteration.
+// `len` must be a multiple of 16 and at least 64. Works on the inverted crc state.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* buf, size_t len) {
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+  __m128i y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+  x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+  x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+  x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(CRC32_K1K2));
+  buf += 64;
+  len -= 64;
+
+  // fold 4 x 128 bits in parallel
+  while (len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+    y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+    y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+    y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    buf += 64;
+    len -= 64;
+  }
+
+  // fold into 128 bits
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(CRC32_K3K4));
+  for (__m128i next : {x2, x3, x4}) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+  }
+
+  // single fold blocks of 128 bits
+  while (len >= 16) {
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    buf += 16;
+    len -= 16;
+  }
+
+  // fold 128 bits to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(CRC32_K5K0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(CRC32_POLY));
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static bool has_pclmul() {
+  static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  return supported;
+}
+
+#endif
+
+uint32_t crc32_update(uint32_t crc, const char* data, size_t len) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (len >= CRC32_PCLMUL_MIN_SIZE && has_pclmul()) {
+    size_t chunk = len & ~static_cast<size_t>(15);
+    crc = crc32_pclmul(crc, bytes, chunk);
+    bytes += chunk;
+    len -= chunk;
+  }
+#endif
+  return ~crc32_slice_by_8(crc, bytes, len);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// zlib compatible CRC-32 (polynomial 0xEDB88320), as used by binlog_checksum=CRC32
+uint32_t crc32_update(uint32_t crc, const char* data, size_t len);
+
+inline uint32_t crc32(const char* data, size_t len) {
+  return crc32_update(0, data, len);
+}
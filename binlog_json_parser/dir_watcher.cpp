@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <poll.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "dir_watcher.h"
+
+
+#if defined(__linux__)
+
+DirWatcher::DirWatcher(const std::string& path) : dir_path(path) {
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(std::string("inotify_init1 failed: ") + std::strerror(errno));
+  }
+  if (inotify_add_watch(fd, path.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+    int error = errno;
+    close(fd);
+    throw std::runtime_error("failed to watch " + path + ": " + std::strerror(error));
+  }
+}
+
+DirWatcher::~DirWatcher() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool DirWatcher::wait(int timeout_ms) {
+  struct pollfd poll_fd = {fd, POLLIN, 0};
+  int result = poll(&poll_fd, 1, timeout_ms);
+  if (result < 0) {
+    if (errno == EINTR) {
+      return true;
+    }
+    throw std::runtime_error("failed to wait for " + dir_path + ": " + std::strerror(errno));
+  }
+  if (result == 0) {
+    return false;
+  }
+  // the events themselves don't matter, the reader checks its files
+  alignas(struct inotify_event) char buffer[4096];
+  while (read(fd, buffer, sizeof(buffer)) > 0) {
+  }
+  return true;
+}
+
+#else
+
+constexpr int DIR_WATCHER_POLL_INTERVAL_MS = 100;
+
+DirWatcher::DirWatcher(const std::string& path) : dir_path(path) {}
+
+DirWatcher::~DirWatcher() {}
+
+bool DirWatcher::wait(int timeout_ms) {
+  poll(nullptr, 0, std::min(timeout_ms, DIR_WATCHER_POLL_INTERVAL_MS));
+  return true;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// Waits for files in a directory to be created or written, so that readers
+// following files of another process don't have to poll them. Uses inotify
+// on Linux, elsewhere wait() sleeps for a short interval and reports a
+// change.
+class DirWatcher {
+public:
+  explicit DirWatcher(const std::string& path);
+  ~DirWatcher();
+
+  DirWatcher(const DirWatcher&) = delete;
+  DirWatcher& operator=(const DirWatcher&) = delete;
+
+  // Returns true if something changed since the previous call, false if
+  // timeout_ms passed without changes.
+  bool wait(int timeout_ms);
+
+private:
+  int fd = -1;
+  std::string dir_path;
+};
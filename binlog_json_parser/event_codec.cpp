@@ -0,0 +1,642 @@
+#include <cstring>
+#include <string>
+
+#include "event_codec.h"
+#include <datetime.h>
+
+#include "civil_date.h"
+#include "my_byteorder.h"
+
+
+constexpr int64_t MICROSECONDS_PER_SECOND = 1000000;
+constexpr int64_t MICROSECONDS_PER_DAY = 86400 * MICROSECONDS_PER_SECOND;
+// timedeltas of more days do not fit int64 microseconds
+constexpr int64_t TIMEDELTA_MAX_DAYS = INT64_MAX / MICROSECONDS_PER_DAY - 1;
+constexpr size_t EVENT_NAME_MAX_SIZE = 0xffff;
+
+static PyObject* pickle_dumps = nullptr;
+static PyObject* pickle_loads = nullptr;
+static PyObject* decimal_type = nullptr;
+
+static bool import_python_modules() {
+  if (decimal_type != nullptr) {
+    return true;
+  }
+  PyDateTime_IMPORT;
+  if (PyDateTimeAPI == nullptr) {
+    return false;
+  }
+  PyObject* pickle = PyImport_ImportModule("pickle");
+  if (pickle == nullptr) {
+    return false;
+  }
+  pickle_dumps = PyObject_GetAttrString(pickle, "dumps");
+  pickle_loads = PyObject_GetAttrString(pickle, "loads");
+  Py_DECREF(pickle);
+  PyObject* decimal = PyImport_ImportModule("decimal");
+  if (decimal == nullptr) {
+    return false;
+  }
+  decimal_type = PyObject_GetAttrString(decimal, "Decimal");
+  Py_DECREF(decimal);
+  return pickle_dumps != nullptr && pickle_loads != nullptr && decimal_type != nullptr;
+}
+
+static void append_uint8(std::string& out, uint8_t value) {
+  out.push_back(static_cast<char>(value));
+}
+
+static void append_uint16(std::string& out, uint16_t value) {
+  char buffer[2];
+  int2store(buffer, value);
+  out.append(buffer, sizeof(buffer));
+}
+
+static void append_uint32(std::string& out, uint32_t value) {
+  char buffer[4];
+  int4store(buffer, value);
+  out.append(buffer, sizeof(buffer));
+}
+
+static void append_int64(std::string& out, int64_t value) {
+  char buffer[8];
+  int8store(buffer, static_cast<uint64_t>(value));
+  out.append(buffer, sizeof(buffer));
+}
+
+static bool append_name(std::string& out, PyObject* name) {
+  Py_ssize_t size;
+  const char* data = PyUnicode_AsUTF8AndSize(name, &size);
+  if (data == nullptr) {
+    return false;
+  }
+  if (static_cast<size_t>(size) > EVENT_NAME_MAX_SIZE) {
+    PyErr_SetString(PyExc_ValueError, "name is too long for the event log");
+    return false;
+  }
+  append_uint16(out, static_cast<uint16_t>(size));
+  out.append(data, size);
+  return true;
+}
+
+static bool append_pickled(std::string& out, PyObject* value) {
+  PyObject* data = PyObject_CallOneArg(pickle_dumps, value);
+  if (data == nullptr) {
+    return false;
+  }
+  append_uint32(out, static_cast<uint32_t>(PyBytes_GET_SIZE(data)));
+  out.append(PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+  Py_DECREF(data);
+  return true;
+}
+
+static uint8_t column_type_of(PyTypeObject* type) {
+  if (type == &PyLong_Type) {
+    return EVENT_COLUMN_INT64;
+  }
+  if (type == &PyUnicode_Type) {
+    return EVENT_COLUMN_STR;
+  }
+  if (type == &PyFloat_Type) {
+    return EVENT_COLUMN_DOUBLE;
+  }
+  if (type == &PyBytes_Type) {
+    return EVENT_COLUMN_BYTES;
+  }
+  if (type == PyDateTimeAPI->DateTimeType) {
+    return EVENT_COLUMN_DATETIME;
+  }
+  if (type == PyDateTimeAPI->DateType) {
+    return EVENT_COLUMN_DATE;
+  }
+  if (type == PyDateTimeAPI->DeltaType) {
+    return EVENT_COLUMN_TIMEDELTA;
+  }
+  if (reinterpret_cast<PyObject*>(type) == decimal_type) {
+    return EVENT_COLUMN_DECIMAL;
+  }
+  return EVENT_COLUMN_PICKLE;
+}
+
+// Appends the values of a typed column. Returns false without an exception
+// set when a value can't be represented, the column is pickled instead.
+static bool append_typed_values(std::string& out, PyObject** rows, size_t row_count,
+                                size_t column, uint8_t column_type) {
+  auto value_at = [&](size_t row) { return PySequence_Fast_ITEMS(rows[row])[column]; };
+
+  switch (column_type) {
+    case EVENT_COLUMN_INT64:
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        int overflow = 0;
+        long long number = value == Py_None ? 0 : PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (overflow) {
+          return false;
+        }
+        append_int64(out, number);
+      }
+      return true;
+
+    case EVENT_COLUMN_DOUBLE:
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        char buffer[8];
+        float8store(buffer, value == Py_None ? 0.0 : PyFloat_AS_DOUBLE(value));
+        out.append(buffer, sizeof(buffer));
+      }
+      return true;
+
+    case EVENT_COLUMN_STR:
+    case EVENT_COLUMN_BYTES:
+    case EVENT_COLUMN_DECIMAL: {
+      size_t sizes_offset = out.size();
+      out.resize(out.size() + row_count * 4);
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        Py_ssize_t size = 0;
+        if (value == Py_None) {
+          // nothing to store
+        } else if (column_type == EVENT_COLUMN_BYTES) {
+          size = PyBytes_GET_SIZE(value);
+          out.append(PyBytes_AS_STRING(value), size);
+        } else if (column_type == EVENT_COLUMN_STR) {
+          const char* data = PyUnicode_AsUTF8AndSize(value, &size);
+          if (data == nullptr) {
+            // lone surrogates, e.g. from surrogateescape
+            PyErr_Clear();
+            return false;
+          }
+          out.append(data, size);
+        } else {
+          PyObject* text = PyObject_Str(value);
+          const char* data = text ? PyUnicode_AsUTF8AndSize(text, &size) : nullptr;
+          if (data == nullptr) {
+            Py_XDECREF(text);
+            PyErr_Clear();
+            return false;
+          }
+          out.append(data, size);
+          Py_DECREF(text);
+        }
+        int4store(&out[sizes_offset + row * 4], static_cast<uint32_t>(size));
+      }
+      return true;
+    }
+
+    case EVENT_COLUMN_DATETIME:
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        int64_t microseconds = 0;
+        if (value != Py_None) {
+          if (PyDateTime_DATE_GET_TZINFO(value) != Py_None || PyDateTime_DATE_GET_FOLD(value)) {
+            return false;
+          }
+          int64_t days = days_from_civil(PyDateTime_GET_YEAR(value), PyDateTime_GET_MONTH(value),
+                                         PyDateTime_GET_DAY(value));
+          int64_t seconds = PyDateTime_DATE_GET_HOUR(value) * 3600 +
+                            PyDateTime_DATE_GET_MINUTE(value) * 60 +
+                            PyDateTime_DATE_GET_SECOND(value);
+          microseconds = days * MICROSECONDS_PER_DAY + seconds * MICROSECONDS_PER_SECOND +
+                         PyDateTime_DATE_GET_MICROSECOND(value);
+        }
+        append_int64(out, microseconds);
+      }
+      return true;
+
+    case EVENT_COLUMN_DATE:
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        int64_t days = 0;
+        if (value != Py_None) {
+          days = days_from_civil(PyDateTime_GET_YEAR(value), PyDateTime_GET_MONTH(value),
+                                 PyDateTime_GET_DAY(value));
+        }
+        append_uint32(out, static_cast<uint32_t>(static_cast<int32_t>(days)));
+      }
+      return true;
+
+    case EVENT_COLUMN_TIMEDELTA:
+      for (size_t row = 0; row < row_count; row++) {
+        PyObject* value = value_at(row);
+        int64_t microseconds = 0;
+        if (value != Py_None) {
+          int64_t days = PyDateTime_DELTA_GET_DAYS(value);
+          if (days > TIMEDELTA_MAX_DAYS || days < -TIMEDELTA_MAX_DAYS) {
+            return false;
+          }
+          microseconds = days * MICROSECONDS_PER_DAY +
+                         PyDateTime_DELTA_GET_SECONDS(value) * MICROSECONDS_PER_SECOND +
+                         PyDateTime_DELTA_GET_MICROSECONDS(value);
+        }
+        append_int64(out, microseconds);
+      }
+      return true;
+  }
+  return false;
+}
+
+static bool append_column(std::string& out, PyObject** rows, size_t row_count, size_t column) {
+  PyTypeObject* value_type = nullptr;
+  bool has_nulls = false;
+  bool mixed = false;
+  for (size_t row = 0; row < row_count; row++) {
+    PyObject* value = PySequence_Fast_ITEMS(rows[row])[column];
+    if (value == Py_None) {
+      has_nulls = true;
+    } else if (value_type == nullptr) {
+      value_type = Py_TYPE(value);
+    } else if (Py_TYPE(value) != value_type) {
+      mixed = true;
+    }
+  }
+
+  if (value_type == nullptr) {
+    append_uint8(out, EVENT_COLUMN_NULL | EVENT_COLUMN_HAS_NULLS);
+    out.append(row_count, '\x01');
+    return true;
+  }
+
+  uint8_t column_type = mixed ? EVENT_COLUMN_PICKLE : column_type_of(value_type);
+  if (column_type != EVENT_COLUMN_PICKLE) {
+    size_t column_offset = out.size();
+    append_uint8(out, column_type | (has_nulls ? EVENT_COLUMN_HAS_NULLS : 0));
+    if (has_nulls) {
+      for (size_t row = 0; row < row_count; row++) {
+        append_uint8(out, PySequence_Fast_ITEMS(rows[row])[column] == Py_None);
+      }
+    }
+    if (append_typed_values(out, rows, row_count, column, column_type)) {
+      return true;
+    }
+    out.resize(column_offset);
+  }
+
+  PyObject* values = PyList_New(row_count);
+  if (values == nullptr) {
+    return false;
+  }
+  for (size_t row = 0; row < row_count; row++) {
+    PyObject* value = PySequence_Fast_ITEMS(rows[row])[column];
+    Py_INCREF(value);
+    PyList_SET_ITEM(values, row, value);
+  }
+  append_uint8(out, EVENT_COLUMN_PICKLE);
+  bool result = append_pickled(out, values);
+  Py_DECREF(values);
+  return result;
+}
+
+// Returns false without an exception set if the event doesn't have the
+// shape of a row event, it is pickled as a whole then.
+static bool append_typed_event(std::string& out, PyObject* transaction_id, PyObject* db_name,
+                               PyObject* table_name, PyObject* records, uint8_t flags) {
+  if (!PyTuple_CheckExact(transaction_id) || PyTuple_GET_SIZE(transaction_id) != 2 ||
+      !PyUnicode_CheckExact(PyTuple_GET_ITEM(transaction_id, 0)) ||
+      !PyLong_CheckExact(PyTuple_GET_ITEM(transaction_id, 1)) ||
+      !PyUnicode_CheckExact(db_name) || !PyUnicode_CheckExact(table_name) ||
+      !PyList_CheckExact(records)) {
+    return false;
+  }
+  size_t row_count = PyList_GET_SIZE(records);
+  PyObject** rows = PySequence_Fast_ITEMS(records);
+  size_t column_count = 0;
+  for (size_t row = 0; row < row_count; row++) {
+    if (!PyList_CheckExact(rows[row]) && !PyTuple_CheckExact(rows[row])) {
+      return false;
+    }
+    size_t size = PySequence_Fast_GET_SIZE(rows[row]);
+    if (row == 0) {
+      column_count = size;
+    } else if (size != column_count) {
+      return false;
+    }
+  }
+  if (row_count > UINT32_MAX || column_count > 0xffff || (row_count > 0 && column_count == 0)) {
+    return false;
+  }
+
+  int overflow = 0;
+  long long log_pos = PyLong_AsLongLongAndOverflow(PyTuple_GET_ITEM(transaction_id, 1), &overflow);
+  if (overflow) {
+    return false;
+  }
+
+  append_uint8(out, flags);
+  if (!append_name(out, PyTuple_GET_ITEM(transaction_id, 0))) {
+    return false;
+  }
+  append_int64(out, log_pos);
+  if (!append_name(out, db_name) || !append_name(out, table_name)) {
+    return false;
+  }
+  append_uint32(out, static_cast<uint32_t>(row_count));
+  append_uint16(out, static_cast<uint16_t>(column_count));
+  for (size_t column = 0; column < column_count; column++) {
+    if (!append_column(out, rows, row_count, column)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+PyObject* encode_log_event(PyObject* transaction_id, PyObject* db_name, PyObject* table_name,
+                           PyObject* records, PyObject* is_removal) {
+  if (!import_python_modules()) {
+    return nullptr;
+  }
+  int removal = PyObject_IsTrue(is_removal);
+  if (removal < 0) {
+    return nullptr;
+  }
+  uint8_t flags = removal ? EVENT_IS_REMOVAL : 0;
+
+  std::string out;
+  if (!append_typed_event(out, transaction_id, db_name, table_name, records, flags)) {
+    if (PyErr_Occurred()) {
+      return nullptr;
+    }
+    out.clear();
+    append_uint8(out, flags | EVENT_PICKLED);
+    PyObject* event = PyTuple_Pack(5, transaction_id, db_name, table_name, records, is_removal);
+    if (event == nullptr) {
+      return nullptr;
+    }
+    PyObject* data = PyObject_CallOneArg(pickle_dumps, event);
+    Py_DECREF(event);
+    if (data == nullptr) {
+      return nullptr;
+    }
+    out.append(PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    Py_DECREF(data);
+  }
+  return PyBytes_FromStringAndSize(out.data(), out.size());
+}
+
+class PayloadCursor {
+public:
+  PayloadCursor(const char* data, size_t size) : data(data), end(data + size) {}
+
+  bool has(size_t size) const { return static_cast<size_t>(end - data) >= size; }
+
+  const char* take(size_t size) {
+    if (!has(size)) {
+      PyErr_SetString(PyExc_ValueError, "truncated event log payload");
+      return nullptr;
+    }
+    const char* result = data;
+    data += size;
+    return result;
+  }
+
+  PyObject* take_name() {
+    const char* size_data = take(2);
+    if (size_data == nullptr) {
+      return nullptr;
+    }
+    uint16_t size = uint2korr(size_data);
+    const char* name = take(size);
+    return name ? PyUnicode_DecodeUTF8(name, size, "strict") : nullptr;
+  }
+
+private:
+  const char* data;
+  const char* end;
+};
+
+static PyObject* decode_value(uint8_t column_type, const char*& values, const char*& blob) {
+  switch (column_type) {
+    case EVENT_COLUMN_INT64: {
+      long long value = sint8korr(values);
+      values += 8;
+      return PyLong_FromLongLong(value);
+    }
+    case EVENT_COLUMN_DOUBLE: {
+      double value = float8get(values);
+      values += 8;
+      return PyFloat_FromDouble(value);
+    }
+    case EVENT_COLUMN_STR:
+    case EVENT_COLUMN_BYTES:
+    case EVENT_COLUMN_DECIMAL: {
+      uint32_t size = uint4korr(values);
+      values += 4;
+      const char* data = blob;
+      blob += size;
+      if (column_type == EVENT_COLUMN_BYTES) {
+        return PyBytes_FromStringAndSize(data, size);
+      }
+      PyObject* text = PyUnicode_DecodeUTF8(data, size, "strict");
+      if (column_type == EVENT_COLUMN_STR || text == nullptr) {
+        return text;
+      }
+      PyObject* result = PyObject_CallOneArg(decimal_type, text);
+      Py_DECREF(text);
+      return result;
+    }
+    case EVENT_COLUMN_DATETIME: {
+      int64_t microseconds = sint8korr(values);
+      values += 8;
+      int64_t days = floor_div(microseconds, MICROSECONDS_PER_DAY);
+      int64_t time = microseconds - days * MICROSECONDS_PER_DAY;
+      int year, month, day;
+      civil_from_days(days, &year, &month, &day);
+      int64_t seconds = time / MICROSECONDS_PER_SECOND;
+      return PyDateTime_FromDateAndTime(year, month, day, seconds / 3600, seconds / 60 % 60,
+                                        seconds % 60, time % MICROSECONDS_PER_SECOND);
+    }
+    case EVENT_COLUMN_DATE: {
+      int32_t days = sint4korr(values);
+      values += 4;
+      int year, month, day;
+      civil_from_days(days, &year, &month, &day);
+      return PyDate_FromDate(year, month, day);
+    }
+    case EVENT_COLUMN_TIMEDELTA: {
+      int64_t microseconds = sint8korr(values);
+      values += 8;
+      int64_t days = floor_div(microseconds, MICROSECONDS_PER_DAY);
+      int64_t time = microseconds - days * MICROSECONDS_PER_DAY;
+      return PyDelta_FromDSU(days, time / MICROSECONDS_PER_SECOND, time % MICROSECONDS_PER_SECOND);
+    }
+  }
+  PyErr_Format(PyExc_ValueError, "unknown event log column type %d", column_type);
+  return nullptr;
+}
+
+static size_t fixed_value_size(uint8_t column_type) {
+  switch (column_type) {
+    case EVENT_COLUMN_DATE:
+    case EVENT_COLUMN_STR:
+    case EVENT_COLUMN_BYTES:
+    case EVENT_COLUMN_DECIMAL:
+      return 4;
+    default:
+      return 8;
+  }
+}
+
+static bool decode_column(PayloadCursor& cursor, PyObject* records, size_t row_count, size_t column) {
+  const char* tag_data = cursor.take(1);
+  if (tag_data == nullptr) {
+    return false;
+  }
+  uint8_t tag = static_cast<uint8_t>(*tag_data);
+  uint8_t column_type = tag & ~EVENT_COLUMN_HAS_NULLS;
+
+  if (column_type == EVENT_COLUMN_PICKLE) {
+    const char* size_data = cursor.take(4);
+    const char* data = size_data ? cursor.take(uint4korr(size_data)) : nullptr;
+    if (data == nullptr) {
+      return false;
+    }
+    PyObject* pickled = PyBytes_FromStringAndSize(data, uint4korr(size_data));
+    PyObject* values = pickled ? PyObject_CallOneArg(pickle_loads, pickled) : nullptr;
+    Py_XDECREF(pickled);
+    if (values == nullptr) {
+      return false;
+    }
+    if (!PyList_CheckExact(values) || static_cast<size_t>(PyList_GET_SIZE(values)) != row_count) {
+      Py_DECREF(values);
+      PyErr_SetString(PyExc_ValueError, "bad pickled event log column");
+      return false;
+    }
+    for (size_t row = 0; row < row_count; row++) {
+      PyObject* value = PyList_GET_ITEM(values, row);
+      Py_INCREF(value);
+      PyList_SET_ITEM(PyList_GET_ITEM(records, row), column, value);
+    }
+    Py_DECREF(values);
+    return true;
+  }
+
+  const char* null_mask = nullptr;
+  if (tag & EVENT_COLUMN_HAS_NULLS) {
+    null_mask = cursor.take(row_count);
+    if (null_mask == nullptr) {
+      return false;
+    }
+  }
+
+  if (column_type == EVENT_COLUMN_NULL) {
+    for (size_t row = 0; row < row_count; row++) {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(PyList_GET_ITEM(records, row), column, Py_None);
+    }
+    return true;
+  }
+
+  const char* values = cursor.take(row_count * fixed_value_size(column_type));
+  if (values == nullptr) {
+    return false;
+  }
+  const char* blob = nullptr;
+  if (column_type == EVENT_COLUMN_STR || column_type == EVENT_COLUMN_BYTES ||
+      column_type == EVENT_COLUMN_DECIMAL) {
+    size_t blob_size = 0;
+    for (size_t row = 0; row < row_count; row++) {
+      blob_size += uint4korr(values + row * 4);
+    }
+    blob = cursor.take(blob_size);
+    if (blob == nullptr) {
+      return false;
+    }
+  }
+
+  for (size_t row = 0; row < row_count; row++) {
+    PyObject* value;
+    if (null_mask != nullptr && null_mask[row]) {
+      values += fixed_value_size(column_type);
+      value = Py_None;
+      Py_INCREF(value);
+    } else {
+      value = decode_value(column_type, values, blob);
+      if (value == nullptr) {
+        return false;
+      }
+    }
+    PyList_SET_ITEM(PyList_GET_ITEM(records, row), column, value);
+  }
+  return true;
+}
+
+PyObject* decode_log_event(const char* data, size_t size) {
+  if (!import_python_modules()) {
+    return nullptr;
+  }
+  if (size == 0) {
+    PyErr_SetString(PyExc_ValueError, "empty event log payload");
+    return nullptr;
+  }
+  uint8_t flags = static_cast<uint8_t>(data[0]);
+  if (flags & EVENT_PICKLED) {
+    PyObject* pickled = PyBytes_FromStringAndSize(data + 1, size - 1);
+    if (pickled == nullptr) {
+      return nullptr;
+    }
+    PyObject* result = PyObject_CallOneArg(pickle_loads, pickled);
+    Py_DECREF(pickled);
+    return result;
+  }
+
+  PayloadCursor cursor(data + 1, size - 1);
+  PyObject* log_file = cursor.take_name();
+  if (log_file == nullptr) {
+    return nullptr;
+  }
+  const char* log_pos_data = cursor.take(8);
+  PyObject* log_pos = log_pos_data ? PyLong_FromLongLong(sint8korr(log_pos_data)) : nullptr;
+  PyObject* db_name = log_pos ? cursor.take_name() : nullptr;
+  PyObject* table_name = db_name ? cursor.take_name() : nullptr;
+  const char* shape = table_name ? cursor.take(6) : nullptr;
+  if (shape == nullptr) {
+    Py_DECREF(log_file);
+    Py_XDECREF(log_pos);
+    Py_XDECREF(db_name);
+    Py_XDECREF(table_name);
+    return nullptr;
+  }
+  size_t row_count = uint4korr(shape);
+  size_t column_count = uint2korr(shape + 4);
+
+  PyObject* records = nullptr;
+  // every row takes at least a byte per column, don't allocate for garbage
+  if ((column_count > 0 || row_count == 0) && cursor.has(row_count * column_count)) {
+    records = PyList_New(row_count);
+  } else {
+    PyErr_SetString(PyExc_ValueError, "truncated event log payload");
+  }
+  for (size_t row = 0; records != nullptr && row < row_count; row++) {
+    PyObject* record = PyList_New(column_count);
+    if (record == nullptr) {
+      Py_CLEAR(records);
+      break;
+    }
+    PyList_SET_ITEM(records, row, record);
+  }
+  for (size_t column = 0; records != nullptr && column < column_count; column++) {
+    if (!decode_column(cursor, records, row_count, column)) {
+      Py_CLEAR(records);
+    }
+  }
+  if (records == nullptr) {
+    Py_DECREF(log_file);
+    Py_DECREF(log_pos);
+    Py_DECREF(db_name);
+    Py_DECREF(table_name);
+    return nullptr;
+  }
+
+  PyObject* transaction_id = PyTuple_Pack(2, log_file, log_pos);
+  Py_DECREF(log_file);
+  Py_DECREF(log_pos);
+  PyObject* result = nullptr;
+  if (transaction_id != nullptr) {
+    result = PyTuple_Pack(5, transaction_id, db_name, table_name, records,
+                          (flags & EVENT_IS_REMOVAL) ? Py_True : Py_False);
+    Py_DECREF(transaction_id);
+  }
+  Py_DECREF(db_name);
+  Py_DECREF(table_name);
+  Py_DECREF(records);
+  return result;
+}
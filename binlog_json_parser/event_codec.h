@@ -0,0 +1,52 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstddef>
+
+// Payload of one event in the binlog replicator event log (event_log.h
+// frames it). Records are stored column by column, little endian:
+//
+//   flags (uint8), binlog file name (uint16 size + utf8), log_pos (int64),
+//   db name, table name (uint16 size + utf8), rows (uint32), columns (uint16),
+//   column blocks
+//
+// A column block is a type tag, a null mask (one byte per row) if the tag
+// has EVENT_COLUMN_HAS_NULLS (always set for NULL columns), then the values:
+//   INT64, DOUBLE, DATETIME, TIMEDELTA: 8 bytes per row (datetimes and
+//     timedeltas in microseconds since 1970-01-01 / microseconds)
+//   DATE: 4 bytes per row, days since 1970-01-01
+//   STR, BYTES, DECIMAL: uint32 size per row, then the concatenated data
+//   PICKLE: uint32 size + a pickled list of the column values
+// Values of other types, mixed types, tz aware datetimes or ints above
+// int64 make the column pickled. An event that doesn't have the expected
+// shape is pickled as a whole (EVENT_PICKLED).
+//
+// Every column block takes at least a byte per row, which bounds what the
+// decoder allocates for a payload.
+//
+// Both functions run with the GIL held (ctypes.PyDLL) and return nullptr
+// with a python exception set on failure.
+
+constexpr uint8_t EVENT_IS_REMOVAL = 1;
+constexpr uint8_t EVENT_PICKLED = 2;
+
+constexpr uint8_t EVENT_COLUMN_NULL = 0;
+constexpr uint8_t EVENT_COLUMN_INT64 = 1;
+constexpr uint8_t EVENT_COLUMN_DOUBLE = 2;
+constexpr uint8_t EVENT_COLUMN_STR = 3;
+constexpr uint8_t EVENT_COLUMN_BYTES = 4;
+constexpr uint8_t EVENT_COLUMN_PICKLE = 5;
+constexpr uint8_t EVENT_COLUMN_DECIMAL = 6;
+constexpr uint8_t EVENT_COLUMN_DATETIME = 7;
+constexpr uint8_t EVENT_COLUMN_DATE = 8;
+constexpr uint8_t EVENT_COLUMN_TIMEDELTA = 9;
+constexpr uint8_t EVENT_COLUMN_HAS_NULLS = 0x80;
+
+// Returns bytes.
+PyObject* encode_log_event(PyObject* transaction_id, PyObject* db_name, PyObject* table_name,
+                           PyObject* records, PyObject* is_removal);
+
+// Returns (transaction_id, db_name, table_name, records, is_removal).
+PyObject* decode_log_event(const char* data, size_t size);
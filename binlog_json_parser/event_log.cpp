@@ -0,0 +1,612 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "event_log.h"
+#include "block_compression.h"
+#include "crc32.h"
+#include "my_byteorder.h"
+
+
+// far above any block the writer produces, guards allocations against a
+// corrupted block header
+constexpr uint32_t EVENT_LOG_MAX_BLOCK_SIZE = 1u << 30;
+
+static void write_all(int fd, struct iovec* iov, int iov_count) {
+  while (iov_count > 0) {
+    ssize_t written = writev(fd, iov, iov_count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("failed to write event log: ") + std::strerror(errno));
+    }
+    size_t left = static_cast<size_t>(written);
+    while (iov_count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --iov_count;
+    }
+    if (iov_count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+}
+
+static bool read_at(int fd, char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t bytes_read = pread(fd, data, size, offset);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("failed to read event log: ") + std::strerror(errno));
+    }
+    if (bytes_read == 0) {
+      return false;
+    }
+    data += bytes_read;
+    size -= bytes_read;
+    offset += bytes_read;
+  }
+  return true;
+}
+
+static void store_block_header(char* header, const EventLogBlockHeader& block_header) {
+  header[0] = static_cast<char>(block_header.type);
+  header[1] = static_cast<char>(block_header.codec);
+  int4store(header + 2, block_header.stored_size);
+  int4store(header + 6, block_header.size);
+  int4store(header + 10, block_header.checksum);
+  int4store(header + 14, block_header.event_count);
+  int2store(header + 18, block_header.first_key_size);
+  int2store(header + 20, block_header.last_key_size);
+  int2store(header + 22, block_header.tag_size);
+  int8store(header + 24, block_header.previous_offset);
+}
+
+static size_t block_info_size(const EventLogBlockHeader& block_header) {
+  return block_header.first_key_size + block_header.last_key_size + block_header.tag_size;
+}
+
+static uint64_t block_stored_size(const EventLogBlockHeader& block_header) {
+  return EVENT_LOG_BLOCK_HEADER_SIZE + block_info_size(block_header) + block_header.stored_size;
+}
+
+static EventLogBlockHeader parse_block_header(const char* header) {
+  EventLogBlockHeader block_header;
+  block_header.type = static_cast<uint8_t>(header[0]);
+  block_header.codec = static_cast<uint8_t>(header[1]);
+  block_header.stored_size = uint4korr(header + 2);
+  block_header.size = uint4korr(header + 6);
+  block_header.checksum = uint4korr(header + 10);
+  block_header.event_count = uint4korr(header + 14);
+  block_header.first_key_size = uint2korr(header + 18);
+  block_header.last_key_size = uint2korr(header + 20);
+  block_header.tag_size = uint2korr(header + 22);
+  block_header.previous_offset = uint8korr(header + 24);
+  if ((block_header.type != EVENT_LOG_BLOCK_EVENTS && block_header.type != EVENT_LOG_BLOCK_INDEX) ||
+      block_header.stored_size > EVENT_LOG_MAX_BLOCK_SIZE || block_header.size > EVENT_LOG_MAX_BLOCK_SIZE) {
+    throw std::runtime_error("bad event log block header");
+  }
+  return block_header;
+}
+
+// keys and tag as they follow the block header
+static void parse_block_info(const char* data, const EventLogBlockHeader& block_header, EventLogBlockInfo& info) {
+  info.event_count = block_header.event_count;
+  info.first_key.assign(data, block_header.first_key_size);
+  data += block_header.first_key_size;
+  info.last_key.assign(data, block_header.last_key_size);
+  data += block_header.last_key_size;
+  info.tag.assign(data, block_header.tag_size);
+}
+
+EventLogWriter::EventLogWriter(const std::string& path, uint8_t codec, size_t block_size)
+    : codec(codec), block_size(block_size) {
+  if (!block_codec_available(codec)) {
+    throw std::runtime_error("compression codec " + std::to_string(codec) + " is not available");
+  }
+  fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open " + path + ": " + std::strerror(errno));
+  }
+  char header[EVENT_LOG_HEADER_SIZE];
+  std::memcpy(header, EVENT_LOG_MAGIC, EVENT_LOG_MAGIC_SIZE);
+  int4store(header + EVENT_LOG_MAGIC_SIZE, EVENT_LOG_VERSION);
+  int8store(header + EVENT_LOG_LAST_BLOCK_OFFSET, 0);
+  struct iovec iov[1] = {{header, sizeof(header)}};
+  try {
+    write_all(fd, iov, 1);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  file_size = EVENT_LOG_HEADER_SIZE;
+}
+
+EventLogWriter::~EventLogWriter() {
+  try {
+    finish();
+  } catch (const std::exception&) {
+    // the file stays readable without the footer
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void EventLogWriter::write_block(uint8_t type, uint8_t block_codec, const std::string& data,
+                                 const EventLogBlockInfo& info) {
+  const std::string* stored = &data;
+  if (block_codec != BLOCK_CODEC_NONE) {
+    compress_block(block_codec, data.data(), data.size(), compressed);
+    stored = &compressed;
+    // incompressible data is stored as is
+    if (compressed.size() >= data.size()) {
+      block_codec = BLOCK_CODEC_NONE;
+      stored = &data;
+    }
+  }
+
+  EventLogBlockHeader block_header;
+  block_header.type = type;
+  block_header.codec = block_codec;
+  block_header.stored_size = static_cast<uint32_t>(stored->size());
+  block_header.size = static_cast<uint32_t>(data.size());
+  uint32_t checksum = crc32(info.first_key.data(), info.first_key.size());
+  checksum = crc32_update(checksum, info.last_key.data(), info.last_key.size());
+  checksum = crc32_update(checksum, info.tag.data(), info.tag.size());
+  block_header.checksum = crc32_update(checksum, stored->data(), stored->size());
+  block_header.event_count = info.event_count;
+  block_header.first_key_size = static_cast<uint16_t>(info.first_key.size());
+  block_header.last_key_size = static_cast<uint16_t>(info.last_key.size());
+  block_header.tag_size = static_cast<uint16_t>(info.tag.size());
+  block_header.previous_offset = last_events_block_offset;
+  char header[EVENT_LOG_BLOCK_HEADER_SIZE];
+  store_block_header(header, block_header);
+
+  struct iovec iov[5] = {
+    {header, sizeof(header)},
+    {const_cast<char*>(info.first_key.data()), info.first_key.size()},
+    {const_cast<char*>(info.last_key.data()), info.last_key.size()},
+    {const_cast<char*>(info.tag.data()), info.tag.size()},
+    {const_cast<char*>(stored->data()), stored->size()},
+  };
+  write_all(fd, iov, 5);
+  if (type == EVENT_LOG_BLOCK_EVENTS) {
+    last_events_block_offset = file_size;
+  }
+  file_size += block_stored_size(block_header);
+}
+
+EventLogWriter::PendingBlock& EventLogWriter::pending_block(std::string_view tag) {
+  if (finished) {
+    throw std::runtime_error("event log is already finished");
+  }
+  if (tag.size() > EVENT_LOG_MAX_KEY_SIZE) {
+    throw std::runtime_error("event log tag is too long");
+  }
+  auto it = pending.find(tag);
+  if (it == pending.end()) {
+    it = pending.emplace(std::string(tag), PendingBlock()).first;
+  }
+  return it->second;
+}
+
+void EventLogWriter::append(const char* payload, uint32_t size, std::string_view key, std::string_view tag) {
+  if (key.size() > EVENT_LOG_MAX_KEY_SIZE) {
+    throw std::runtime_error("event log key is too long");
+  }
+  PendingBlock& block = pending_block(tag);
+  if (block.event_count == 0) {
+    block.first_key.assign(key);
+  }
+  block.last_key.assign(key);
+  char frame_header[EVENT_LOG_FRAME_HEADER_SIZE];
+  int4store(frame_header, size);
+  block.data.append(frame_header, sizeof(frame_header));
+  block.data.append(payload, size);
+  block.event_count++;
+  if (block.data.size() >= block_size) {
+    flush_block(std::string(tag), block);
+  }
+}
+
+void EventLogWriter::append_block(const char* data, size_t size, const EventLogBlockInfo& info) {
+  PendingBlock& block = pending_block(info.tag);
+  if (info.event_count == 0) {
+    return;
+  }
+  if (block.event_count == 0) {
+    block.first_key = info.first_key;
+  }
+  block.last_key = info.last_key;
+  block.data.append(data, size);
+  block.event_count += info.event_count;
+  if (block.data.size() >= block_size) {
+    flush_block(info.tag, block);
+  }
+}
+
+void EventLogWriter::flush_block(const std::string& tag, PendingBlock& block) {
+  EventLogBlockInfo info{file_size, block.event_count, block.first_key, block.last_key, tag};
+  write_block(EVENT_LOG_BLOCK_EVENTS, codec, block.data, info);
+
+  // readers start looking for the last event here, they walk over blocks
+  // written after it so the header may lag behind after a crash
+  char last_block_offset[8];
+  int8store(last_block_offset, info.offset);
+  if (pwrite(fd, last_block_offset, sizeof(last_block_offset), EVENT_LOG_LAST_BLOCK_OFFSET) !=
+      static_cast<ssize_t>(sizeof(last_block_offset))) {
+    throw std::runtime_error(std::string("failed to write event log: ") + std::strerror(errno));
+  }
+  blocks.push_back(std::move(info));
+  block.data.clear();
+  block.event_count = 0;
+}
+
+void EventLogWriter::flush() {
+  for (auto& [tag, block] : pending) {
+    if (block.event_count > 0) {
+      flush_block(tag, block);
+    }
+  }
+}
+
+void EventLogWriter::sync() {
+  flush();
+#if defined(__APPLE__)
+  int result = fsync(fd);
+#else
+  int result = fdatasync(fd);
+#endif
+  if (result != 0) {
+    throw std::runtime_error(std::string("failed to sync event log: ") + std::strerror(errno));
+  }
+}
+
+void EventLogWriter::finish() {
+  if (finished) {
+    return;
+  }
+  flush();
+  std::string index;
+  for (const auto& info : blocks) {
+    char entry[EVENT_LOG_INDEX_ENTRY_SIZE];
+    int8store(entry, info.offset);
+    int4store(entry + 8, info.event_count);
+    int2store(entry + 12, static_cast<uint16_t>(info.first_key.size()));
+    int2store(entry + 14, static_cast<uint16_t>(info.last_key.size()));
+    int2store(entry + 16, static_cast<uint16_t>(info.tag.size()));
+    index.append(entry, sizeof(entry));
+    index.append(info.first_key);
+    index.append(info.last_key);
+    index.append(info.tag);
+  }
+  uint64_t index_offset = file_size;
+  EventLogBlockInfo index_info{index_offset, static_cast<uint32_t>(blocks.size()), {}, {}, {}};
+  write_block(EVENT_LOG_BLOCK_INDEX, BLOCK_CODEC_NONE, index, index_info);
+
+  char trailer[EVENT_LOG_TRAILER_SIZE];
+  int8store(trailer, index_offset);
+  std::memcpy(trailer + 8, EVENT_LOG_INDEX_MAGIC, EVENT_LOG_MAGIC_SIZE);
+  struct iovec iov[1] = {{trailer, sizeof(trailer)}};
+  write_all(fd, iov, 1);
+  file_size += sizeof(trailer);
+  finished = true;
+}
+
+EventLogReader::EventLogReader(const std::string& path) : file_path(path) {
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open " + path + ": " + std::strerror(errno));
+  }
+}
+
+EventLogReader::EventLogReader(const std::string& path, const std::string& tag) : EventLogReader(path) {
+  filter_tag = true;
+  this->tag = tag;
+}
+
+EventLogReader::~EventLogReader() {
+  if (mapping) {
+    munmap(mapping, mapped_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool EventLogReader::map(uint64_t end) {
+  if (end <= mapped_size) {
+    return true;
+  }
+  uint64_t file_size = current_file_size();
+  if (end > file_size) {
+    return false;
+  }
+  // the file grew since it was mapped, pointers into the old mapping
+  // don't outlive the block they were returned for
+  if (mapping) {
+    munmap(mapping, mapped_size);
+    mapping = nullptr;
+    mapped_size = 0;
+  }
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("failed to mmap " + file_path + ": " + std::strerror(errno));
+  }
+  mapping = static_cast<char*>(mapped);
+  mapped_size = file_size;
+  madvise(mapping, mapped_size, MADV_SEQUENTIAL);
+  return true;
+}
+
+bool EventLogReader::load_block() {
+  if (finished) {
+    return false;
+  }
+  if (!header_checked) {
+    if (!map(EVENT_LOG_HEADER_SIZE)) {
+      return false;
+    }
+    if (std::memcmp(mapping, EVENT_LOG_MAGIC, EVENT_LOG_MAGIC_SIZE) != 0) {
+      throw std::runtime_error("bad event log magic bytes: " + file_path);
+    }
+    uint32_t version = uint4korr(mapping + EVENT_LOG_MAGIC_SIZE);
+    if (version != EVENT_LOG_VERSION) {
+      throw std::runtime_error("unsupported event log version " + std::to_string(version) + ": " + file_path);
+    }
+    position = EVENT_LOG_HEADER_SIZE;
+    header_checked = true;
+  }
+
+  while (true) {
+    // only complete blocks are read, a block the writer is still writing
+    // is picked up by a later call
+    if (!map(position + EVENT_LOG_BLOCK_HEADER_SIZE)) {
+      return false;
+    }
+    EventLogBlockHeader block_header = parse_block_header(mapping + position);
+    if (block_header.type == EVENT_LOG_BLOCK_INDEX) {
+      // the footer, the file is complete
+      finished = true;
+      return false;
+    }
+    uint64_t stored_block_size = block_stored_size(block_header);
+    if (!map(position + stored_block_size)) {
+      return false;
+    }
+    const char* info_data = mapping + position + EVENT_LOG_BLOCK_HEADER_SIZE;
+    size_t info_size = block_info_size(block_header);
+    if (filter_tag) {
+      std::string_view block_tag(info_data + info_size - block_header.tag_size, block_header.tag_size);
+      if (block_tag != tag) {
+        // another stream of a shared file, its pages aren't even touched
+        position += stored_block_size;
+        continue;
+      }
+    }
+
+    const char* stored = info_data + info_size;
+    uint32_t checksum = crc32(info_data, info_size);
+    if (crc32_update(checksum, stored, block_header.stored_size) != block_header.checksum) {
+      throw std::runtime_error("event log block checksum mismatch: " + file_path);
+    }
+    if (block_header.codec == BLOCK_CODEC_NONE) {
+      if (block_header.stored_size != block_header.size) {
+        throw std::runtime_error("bad uncompressed block size: " + file_path);
+      }
+      // frames are read in place
+      block_data = stored;
+    } else {
+      block.resize(block_header.size);
+      decompress_block(block_header.codec, stored, block_header.stored_size, block.data(), block.size());
+      block_data = block.data();
+    }
+    block_data_size = block_header.size;
+    parse_block_info(info_data, block_header, block_info);
+    position += stored_block_size;
+    block_position = 0;
+    return true;
+  }
+}
+
+bool EventLogReader::next(const char** payload, uint32_t* size) {
+  while (block_position >= block_data_size) {
+    if (!load_block()) {
+      return false;
+    }
+  }
+  if (block_data_size - block_position < EVENT_LOG_FRAME_HEADER_SIZE) {
+    throw std::runtime_error("truncated event log frame: " + file_path);
+  }
+  uint32_t payload_size = uint4korr(block_data + block_position);
+  block_position += EVENT_LOG_FRAME_HEADER_SIZE;
+  if (block_data_size - block_position < payload_size) {
+    throw std::runtime_error("truncated event log frame: " + file_path);
+  }
+  *payload = block_data + block_position;
+  *size = payload_size;
+  block_position += payload_size;
+  return true;
+}
+
+bool EventLogReader::next_block(const char** data, size_t* size, const EventLogBlockInfo** info) {
+  if (!load_block()) {
+    return false;
+  }
+  block_position = block_data_size;
+  *data = block_data;
+  *size = block_data_size;
+  *info = &block_info;
+  return true;
+}
+
+void EventLogReader::seek(uint64_t offset) {
+  position = offset;
+  block_data = nullptr;
+  block_data_size = 0;
+  block_position = 0;
+  finished = false;
+  header_checked = offset >= EVENT_LOG_HEADER_SIZE;
+}
+
+const std::vector<EventLogBlockInfo>& EventLogReader::read_index() {
+  index.clear();
+  uint64_t file_size = current_file_size();
+
+  char trailer[EVENT_LOG_TRAILER_SIZE];
+  if (file_size >= EVENT_LOG_HEADER_SIZE + EVENT_LOG_BLOCK_HEADER_SIZE + EVENT_LOG_TRAILER_SIZE &&
+      read_at(fd, trailer, sizeof(trailer), file_size - EVENT_LOG_TRAILER_SIZE) &&
+      std::memcmp(trailer + 8, EVENT_LOG_INDEX_MAGIC, EVENT_LOG_MAGIC_SIZE) == 0) {
+    uint64_t index_offset = uint8korr(trailer);
+    char header[EVENT_LOG_BLOCK_HEADER_SIZE];
+    if (!read_at(fd, header, sizeof(header), index_offset)) {
+      throw std::runtime_error("bad event log index offset: " + file_path);
+    }
+    EventLogBlockHeader block_header = parse_block_header(header);
+    std::vector<char> data(block_header.stored_size);
+    if (block_header.type != EVENT_LOG_BLOCK_INDEX || block_header.codec != BLOCK_CODEC_NONE ||
+        block_info_size(block_header) != 0 ||
+        !read_at(fd, data.data(), data.size(), index_offset + EVENT_LOG_BLOCK_HEADER_SIZE) ||
+        crc32(data.data(), data.size()) != block_header.checksum) {
+      throw std::runtime_error("bad event log index: " + file_path);
+    }
+    size_t position = 0;
+    for (size_t i = 0; i < block_header.event_count; i++) {
+      if (data.size() - position < EVENT_LOG_INDEX_ENTRY_SIZE) {
+        throw std::runtime_error("bad event log index: " + file_path);
+      }
+      const char* entry = data.data() + position;
+      EventLogBlockHeader entry_header{};
+      entry_header.event_count = uint4korr(entry + 8);
+      entry_header.first_key_size = uint2korr(entry + 12);
+      entry_header.last_key_size = uint2korr(entry + 14);
+      entry_header.tag_size = uint2korr(entry + 16);
+      position += EVENT_LOG_INDEX_ENTRY_SIZE;
+      if (data.size() - position < block_info_size(entry_header)) {
+        throw std::runtime_error("bad event log index: " + file_path);
+      }
+      EventLogBlockInfo& info = index.emplace_back();
+      info.offset = uint8korr(entry);
+      parse_block_info(data.data() + position, entry_header, info);
+      position += block_info_size(entry_header);
+    }
+    return index;
+  }
+
+  // the file is still being written
+  uint64_t offset = EVENT_LOG_HEADER_SIZE;
+  EventLogBlockHeader block_header;
+  std::vector<char> info_data;
+  while (read_block_at(offset, file_size, block_header)) {
+    info_data.resize(block_info_size(block_header));
+    if (!read_at(fd, info_data.data(), info_data.size(), offset + EVENT_LOG_BLOCK_HEADER_SIZE)) {
+      break;
+    }
+    EventLogBlockInfo& info = index.emplace_back();
+    info.offset = offset;
+    parse_block_info(info_data.data(), block_header, info);
+    offset += block_stored_size(block_header);
+  }
+  return index;
+}
+
+const std::string* EventLogReader::read_last_key() {
+  uint64_t file_size = current_file_size();
+  char header[EVENT_LOG_HEADER_SIZE];
+  if (!read_at(fd, header, sizeof(header), 0)) {
+    return nullptr;
+  }
+  if (std::memcmp(header, EVENT_LOG_MAGIC, EVENT_LOG_MAGIC_SIZE) != 0) {
+    throw std::runtime_error("bad event log magic bytes: " + file_path);
+  }
+  uint32_t version = uint4korr(header + EVENT_LOG_MAGIC_SIZE);
+  if (version != EVENT_LOG_VERSION) {
+    throw std::runtime_error("unsupported event log version " + std::to_string(version) + ": " + file_path);
+  }
+  uint64_t offset = uint8korr(header + EVENT_LOG_LAST_BLOCK_OFFSET);
+  if (offset == 0) {
+    offset = EVENT_LOG_HEADER_SIZE;
+  }
+
+  uint64_t last_offset = 0;
+  EventLogBlockHeader block_header;
+  EventLogBlockHeader last_header{};
+  while (read_block_at(offset, file_size, block_header)) {
+    last_offset = offset;
+    last_header = block_header;
+    offset += block_stored_size(block_header);
+  }
+
+  // the header points at the last block of any tag, the blocks of the
+  // other tags written since are skipped backwards
+  std::string block_tag;
+  while (last_offset != 0 && filter_tag) {
+    block_tag.resize(last_header.tag_size);
+    uint64_t tag_offset = last_offset + EVENT_LOG_BLOCK_HEADER_SIZE + last_header.first_key_size +
+                          last_header.last_key_size;
+    if (!read_at(fd, block_tag.data(), block_tag.size(), tag_offset)) {
+      throw std::runtime_error("truncated event log block: " + file_path);
+    }
+    if (block_tag == tag) {
+      break;
+    }
+    if (last_header.previous_offset >= last_offset) {
+      throw std::runtime_error("bad event log previous block offset: " + file_path);
+    }
+    last_offset = last_header.previous_offset;
+    if (last_offset != 0 && !read_block_at(last_offset, file_size, last_header)) {
+      throw std::runtime_error("bad event log previous block offset: " + file_path);
+    }
+  }
+  if (last_offset == 0) {
+    return nullptr;
+  }
+  last_key.resize(last_header.last_key_size);
+  uint64_t key_offset = last_offset + EVENT_LOG_BLOCK_HEADER_SIZE + last_header.first_key_size;
+  if (!read_at(fd, last_key.data(), last_key.size(), key_offset)) {
+    throw std::runtime_error("truncated event log block: " + file_path);
+  }
+  return &last_key;
+}
+
+bool EventLogReader::read_block_at(uint64_t offset, uint64_t file_size, EventLogBlockHeader& block_header) {
+  char header[EVENT_LOG_BLOCK_HEADER_SIZE];
+  if (!read_at(fd, header, sizeof(header), offset)) {
+    return false;
+  }
+  block_header = parse_block_header(header);
+  return block_header.type == EVENT_LOG_BLOCK_EVENTS && offset + block_stored_size(block_header) <= file_size;
+}
+
+uint64_t EventLogReader::current_file_size() {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw std::runtime_error("failed to stat " + file_path + ": " + std::strerror(errno));
+  }
+  return st.st_size;
+}
+
+void compact_event_log(const std::string& src_path, const std::string& dst_path, uint8_t codec, size_t block_size) {
+  EventLogReader reader(src_path);
+  EventLogWriter writer(dst_path, codec, block_size);
+  const char* data;
+  size_t size;
+  const EventLogBlockInfo* info;
+  while (reader.next_block(&data, &size, &info)) {
+    writer.append_block(data, size, *info);
+  }
+  writer.finish();
+  writer.sync();
+}
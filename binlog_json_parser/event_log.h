@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Event log files written by the binlog replicator:
+//   header: magic (4 bytes) + format version (uint32) + offset of the last
+//           written events block (uint64, 0 before the first one)
+//   blocks: block header + (compressed) data
+//   footer, once the file is complete: an index block + index trailer
+//
+// Block header: type (uint8), codec (uint8), stored size, uncompressed size,
+// crc32 of everything after the header, event count (uint32 each), sizes of
+// the keys of the first and the last event and of the tag (uint16 each),
+// offset of the previous events block (uint64, 0 for the first), then the
+// keys, the tag and the stored data. The uncompressed data of an
+// events block is a sequence of frames: payload size (uint32) + payload.
+//
+// Payloads, keys and tags are opaque to this layer. Keys are expected to
+// grow bytewise within a tag so that readers can binary search the blocks.
+// A block only has events of one tag, which lets a file shared by several
+// streams (databases) be read per stream without decompressing the blocks
+// of the others. Files of a single stream use the empty tag. The last
+// block of a tag is found by following the previous block offsets back
+// from the last block of the file.
+//
+// The index block (stored uncompressed) has an entry per events block: its
+// file offset (uint64), event count (uint32), the three sizes (uint16 each)
+// + first key, last key and tag. The trailer is the offset of the index
+// block (uint64) + EVENT_LOG_INDEX_MAGIC. All integers are little endian.
+constexpr char EVENT_LOG_MAGIC[] = "CHEL";
+constexpr char EVENT_LOG_INDEX_MAGIC[] = "CHEI";
+constexpr size_t EVENT_LOG_MAGIC_SIZE = 4;
+constexpr uint32_t EVENT_LOG_VERSION = 2;
+constexpr size_t EVENT_LOG_HEADER_SIZE = 16;
+constexpr size_t EVENT_LOG_LAST_BLOCK_OFFSET = 8;
+constexpr size_t EVENT_LOG_BLOCK_HEADER_SIZE = 32;
+constexpr size_t EVENT_LOG_FRAME_HEADER_SIZE = 4;
+constexpr size_t EVENT_LOG_INDEX_ENTRY_SIZE = 18;
+constexpr size_t EVENT_LOG_TRAILER_SIZE = 12;
+constexpr uint8_t EVENT_LOG_BLOCK_EVENTS = 1;
+constexpr uint8_t EVENT_LOG_BLOCK_INDEX = 2;
+constexpr size_t EVENT_LOG_DEFAULT_BLOCK_SIZE = 1 << 20;
+constexpr size_t EVENT_LOG_MAX_KEY_SIZE = 0xffff;
+
+struct EventLogBlockHeader {
+  uint8_t type;
+  uint8_t codec;
+  uint32_t stored_size;
+  uint32_t size;
+  uint32_t checksum;
+  uint32_t event_count;
+  uint16_t first_key_size;
+  uint16_t last_key_size;
+  uint16_t tag_size;
+  uint64_t previous_offset;
+};
+
+struct EventLogBlockInfo {
+  uint64_t offset;
+  uint32_t event_count;
+  std::string first_key;
+  std::string last_key;
+  std::string tag;
+};
+
+// Events are buffered into blocks of about block_size bytes per tag, a
+// block is compressed and written when it is full or on flush().
+class EventLogWriter {
+public:
+  EventLogWriter(const std::string& path, uint8_t codec, size_t block_size);
+  ~EventLogWriter();
+
+  EventLogWriter(const EventLogWriter&) = delete;
+  EventLogWriter& operator=(const EventLogWriter&) = delete;
+
+  void append(const char* payload, uint32_t size, std::string_view key, std::string_view tag);
+  // Appends the frames of a block read with EventLogReader::next_block.
+  void append_block(const char* data, size_t size, const EventLogBlockInfo& info);
+  void flush();
+  // Flushes and waits until the written data is on disk.
+  void sync();
+  // Flushes and writes the index footer, nothing can be appended after.
+  void finish();
+  uint64_t size() const { return file_size; }
+
+private:
+  struct PendingBlock {
+    std::string data;
+    uint32_t event_count = 0;
+    std::string first_key;
+    std::string last_key;
+  };
+
+  PendingBlock& pending_block(std::string_view tag);
+  void flush_block(const std::string& tag, PendingBlock& block);
+  void write_block(uint8_t type, uint8_t codec, const std::string& data, const EventLogBlockInfo& info);
+
+  int fd = -1;
+  uint8_t codec;
+  size_t block_size;
+  uint64_t file_size = 0;
+  uint64_t last_events_block_offset = 0;
+  std::map<std::string, PendingBlock, std::less<>> pending;  // tag => block
+  std::string compressed;
+  std::vector<EventLogBlockInfo> blocks;
+  bool finished = false;
+};
+
+// Sequential reader over the file mapped into memory, the file may still be
+// appended to by a writer in another process: an incomplete trailing block
+// is reported as "no event yet" and is read once it has been written
+// completely (the file is mapped again when it grew). Payloads of
+// uncompressed blocks point into the mapping, others into the decompressed
+// block. Files are never truncated, a compacted file replaces the old one
+// by a rename.
+class EventLogReader {
+public:
+  // Reads the blocks of all tags.
+  explicit EventLogReader(const std::string& path);
+  // Reads only the blocks of `tag`, the others are skipped.
+  EventLogReader(const std::string& path, const std::string& tag);
+  ~EventLogReader();
+
+  EventLogReader(const EventLogReader&) = delete;
+  EventLogReader& operator=(const EventLogReader&) = delete;
+
+  // The payload stays valid until the next call.
+  bool next(const char** payload, uint32_t* size);
+
+  // Reads the next events block as a whole (its frames), for copying
+  // events between files. Not to be mixed with next() within a block.
+  // The offset of the returned info is not set.
+  bool next_block(const char** data, size_t* size, const EventLogBlockInfo** info);
+
+  // Continue reading from the block at `offset` (an index entry).
+  void seek(uint64_t offset);
+
+  // next() reached the footer: the writer finished the file, there are
+  // no more events to come.
+  bool is_finished() const { return finished; }
+
+  // Blocks of the file, from the footer if the file is complete,
+  // otherwise by walking the block headers. Valid until the next call.
+  const std::vector<EventLogBlockInfo>& read_index();
+  const EventLogBlockInfo& index_entry(size_t position) const { return index[position]; }
+
+  // Key of the last written event (of the tag), found through the last
+  // block offset in the file header and, when reading one tag, the
+  // previous block offsets from there. nullptr if there are no events
+  // (of the tag) yet, otherwise valid until the next call.
+  const std::string* read_last_key();
+
+private:
+  // Makes the file up to `end` readable through the mapping, false if
+  // it isn't written that far yet.
+  bool map(uint64_t end);
+  bool load_block();
+  // Reads the header of the complete events block at offset, false at the
+  // end of the written blocks.
+  bool read_block_at(uint64_t offset, uint64_t file_size, EventLogBlockHeader& block_header);
+  uint64_t current_file_size();
+
+  int fd = -1;
+  std::string file_path;
+  bool filter_tag = false;
+  std::string tag;
+  char* mapping = nullptr;
+  uint64_t mapped_size = 0;
+  uint64_t position = 0;  // of the next block
+  bool header_checked = false;
+  bool finished = false;
+  std::vector<char> block;  // decompressed
+  const char* block_data = nullptr;  // frames of the current block
+  size_t block_data_size = 0;
+  size_t block_position = 0;
+  EventLogBlockInfo block_info;
+  std::vector<EventLogBlockInfo> index;
+  std::string last_key;
+};
+
+// Rewrites the complete blocks of the event log at src_path into a new
+// file at dst_path, merged into blocks of about block_size bytes and
+// compressed with codec. The new file is synced before returning.
+void compact_event_log(const std::string& src_path, const std::string& dst_path, uint8_t codec, size_t block_size);
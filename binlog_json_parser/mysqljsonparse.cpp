@@ -1,11 +1,82 @@
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include "mysql_json_parser.h"
+#include "row_bitmap.h"
+#include "binlog_event_filter.h"
+#include "crc32.h"
+#include "binlog_file_reader.h"
+#include "event_log.h"
+#include "dir_watcher.h"
+#include "clickhouse_native.h"
+#include "staging_table.h"
+#include "block_compression.h"
+#include "event_codec.h"
 
 extern "C" {
   void test_func();
   const char* test_str_func(const char* str, size_t size);
   const char* mysql_to_json(const char* str, size_t size);
+  const char* mysql_to_json_range(const char* buffer, size_t offset, size_t size);
+  size_t bitmap_bit_count(const uint8_t* bitmap, size_t size);
+  size_t row_bitmaps_expand(const uint8_t* cols_bitmap, const uint8_t* null_bitmap,
+                            size_t column_count, uint8_t* states);
+  uint32_t crc32_checksum(const char* data, size_t offset, size_t size);
+  int binlog_event_checksum_state(const char* packet, size_t size);
+  void* binlog_filter_create();
+  void binlog_filter_destroy(void* filter);
+  void binlog_filter_set_verify_checksum(void* filter, int verify);
+  void binlog_filter_allow_event_type(void* filter, int event_type);
+  void binlog_filter_allow_all_event_types(void* filter);
+  void binlog_filter_enable_only(void* filter, int schemas, int tables);
+  void binlog_filter_add_schema(void* filter, const char* schema, size_t size, int ignored);
+  void binlog_filter_add_table(void* filter, const char* table, size_t size, int ignored);
+  int binlog_filter_check(void* filter, const char* packet, size_t size, BinlogEventHeader* header);
+  void* binlog_file_open(const char* path, char* error, size_t error_size);
+  void binlog_file_close(void* reader);
+  int binlog_file_next(void* reader, uint64_t* offset, uint32_t* size);
+  void binlog_file_seek(void* reader, uint64_t position);
+  const char* binlog_file_data(void* reader);
+  int binlog_file_checksum_enabled(void* reader);
+  int event_log_codec_available(int codec);
+  void* event_log_writer_open(const char* path, int codec, size_t block_size, char* error, size_t error_size);
+  void event_log_writer_close(void* writer);
+  int event_log_writer_append(void* writer, const char* payload, size_t size, const char* key, size_t key_size,
+                              const char* tag, size_t tag_size, char* error, size_t error_size);
+  int event_log_writer_flush(void* writer, char* error, size_t error_size);
+  int event_log_writer_sync(void* writer, char* error, size_t error_size);
+  int event_log_writer_finish(void* writer, char* error, size_t error_size);
+  uint64_t event_log_writer_size(void* writer);
+  void* event_log_reader_open(const char* path, const char* tag, size_t tag_size, char* error, size_t error_size);
+  void event_log_reader_close(void* reader);
+  int event_log_reader_next(void* reader, const char** payload, uint32_t* size, char* error, size_t error_size);
+  int event_log_reader_seek(void* reader, uint64_t offset, char* error, size_t error_size);
+  int event_log_reader_finished(void* reader);
+  int64_t event_log_reader_index(void* reader, char* error, size_t error_size);
+  void event_log_reader_index_entry(void* reader, size_t position, uint64_t* offset, uint32_t* event_count,
+                                    const char** first_key, size_t* first_key_size, const char** last_key,
+                                    size_t* last_key_size, const char** tag, size_t* tag_size);
+  int event_log_reader_last_key(void* reader, const char** key, size_t* key_size, char* error, size_t error_size);
+  int event_log_compact(const char* src_path, const char* dst_path, int codec, size_t block_size, char* error,
+                        size_t error_size);
+  void* dir_watcher_open(const char* path, char* error, size_t error_size);
+  void dir_watcher_close(void* watcher);
+  int dir_watcher_wait(void* watcher, int timeout_ms, char* error, size_t error_size);
+  PyObject* event_log_encode(PyObject* transaction_id, PyObject* db_name, PyObject* table_name,
+                             PyObject* records, PyObject* is_removal);
+  PyObject* event_log_decode(const char* data, size_t size);
+  PyObject* event_log_reader_next_event(void* reader);
+  int clickhouse_type_supported(const char* type);
+  PyObject* clickhouse_encode_native(PyObject* records, PyObject* column_names, PyObject* column_types,
+                                     PyObject* versions);
+  void* staging_table_create();
+  void staging_table_free(void* table);
+  Py_ssize_t staging_table_apply(void* table, PyObject* records, Py_ssize_t key_index, int is_removal,
+                                 uint64_t first_version);
+  PyObject* staging_table_take(void* table);
+  size_t staging_table_insert_count(void* table);
+  size_t staging_table_delete_count(void* table);
+  unsigned long event_codec_python_version();
 }
 
 void test_func() {
@@ -22,3 +93,337 @@ const char* mysql_to_json(const char* str, size_t size) {
   last_call_result = parse_mysql_json(str, size);
   return last_call_result.c_str();
 }
+
+const char* mysql_to_json_range(const char* buffer, size_t offset, size_t size) {
+  return mysql_to_json(buffer + offset, size);
+}
+
+size_t bitmap_bit_count(const uint8_t* bitmap, size_t size) {
+  return bitmap_count(bitmap, size);
+}
+
+size_t row_bitmaps_expand(const uint8_t* cols_bitmap, const uint8_t* null_bitmap,
+                          size_t column_count, uint8_t* states) {
+  return expand_row_bitmaps(cols_bitmap, null_bitmap, column_count, states);
+}
+
+uint32_t crc32_checksum(const char* data, size_t offset, size_t size) {
+  return crc32(data + offset, size);
+}
+
+int binlog_event_checksum_state(const char* packet, size_t size) {
+  return verify_event_checksum(packet, size);
+}
+
+void* binlog_filter_create() {
+  return new BinlogEventFilter();
+}
+
+void binlog_filter_destroy(void* filter) {
+  delete static_cast<BinlogEventFilter*>(filter);
+}
+
+void binlog_filter_set_verify_checksum(void* filter, int verify) {
+  static_cast<BinlogEventFilter*>(filter)->set_verify_checksum(verify != 0);
+}
+
+void binlog_filter_allow_event_type(void* filter, int event_type) {
+  static_cast<BinlogEventFilter*>(filter)->allow_event_type(static_cast<uint8_t>(event_type));
+}
+
+void binlog_filter_allow_all_event_types(void* filter) {
+  static_cast<BinlogEventFilter*>(filter)->allow_all_event_types();
+}
+
+void binlog_filter_enable_only(void* filter, int schemas, int tables) {
+  auto* event_filter = static_cast<BinlogEventFilter*>(filter);
+  if (schemas) {
+    event_filter->enable_only_schemas();
+  }
+  if (tables) {
+    event_filter->enable_only_tables();
+  }
+}
+
+void binlog_filter_add_schema(void* filter, const char* schema, size_t size, int ignored) {
+  static_cast<BinlogEventFilter*>(filter)->add_schema(std::string(schema, size), ignored != 0);
+}
+
+void binlog_filter_add_table(void* filter, const char* table, size_t size, int ignored) {
+  static_cast<BinlogEventFilter*>(filter)->add_table(std::string(table, size), ignored != 0);
+}
+
+int binlog_filter_check(void* filter, const char* packet, size_t size, BinlogEventHeader* header) {
+  return static_cast<BinlogEventFilter*>(filter)->check(packet, size, header);
+}
+
+void* binlog_file_open(const char* path, char* error, size_t error_size) {
+  try {
+    return new BinlogFileReader(path);
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return nullptr;
+  }
+}
+
+void binlog_file_close(void* reader) {
+  delete static_cast<BinlogFileReader*>(reader);
+}
+
+int binlog_file_next(void* reader, uint64_t* offset, uint32_t* size) {
+  return static_cast<BinlogFileReader*>(reader)->next(offset, size);
+}
+
+void binlog_file_seek(void* reader, uint64_t position) {
+  static_cast<BinlogFileReader*>(reader)->seek(position);
+}
+
+const char* binlog_file_data(void* reader) {
+  return static_cast<BinlogFileReader*>(reader)->data();
+}
+
+int binlog_file_checksum_enabled(void* reader) {
+  return static_cast<BinlogFileReader*>(reader)->checksum_enabled();
+}
+
+int event_log_codec_available(int codec) {
+  return block_codec_available(static_cast<uint8_t>(codec));
+}
+
+void* event_log_writer_open(const char* path, int codec, size_t block_size, char* error, size_t error_size) {
+  try {
+    return new EventLogWriter(path, static_cast<uint8_t>(codec), block_size);
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return nullptr;
+  }
+}
+
+void event_log_writer_close(void* writer) {
+  delete static_cast<EventLogWriter*>(writer);
+}
+
+int event_log_writer_append(void* writer, const char* payload, size_t size, const char* key, size_t key_size,
+                            const char* tag, size_t tag_size, char* error, size_t error_size) {
+  try {
+    static_cast<EventLogWriter*>(writer)->append(payload, static_cast<uint32_t>(size),
+                                                 std::string_view(key, key_size), std::string_view(tag, tag_size));
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+int event_log_writer_flush(void* writer, char* error, size_t error_size) {
+  try {
+    static_cast<EventLogWriter*>(writer)->flush();
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+int event_log_writer_sync(void* writer, char* error, size_t error_size) {
+  try {
+    static_cast<EventLogWriter*>(writer)->sync();
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+int event_log_writer_finish(void* writer, char* error, size_t error_size) {
+  try {
+    static_cast<EventLogWriter*>(writer)->finish();
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+uint64_t event_log_writer_size(void* writer) {
+  return static_cast<EventLogWriter*>(writer)->size();
+}
+
+// Reads the events of all tags if tag is null.
+void* event_log_reader_open(const char* path, const char* tag, size_t tag_size, char* error, size_t error_size) {
+  try {
+    if (tag != nullptr) {
+      return new EventLogReader(path, std::string(tag, tag_size));
+    }
+    return new EventLogReader(path);
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return nullptr;
+  }
+}
+
+void event_log_reader_close(void* reader) {
+  delete static_cast<EventLogReader*>(reader);
+}
+
+int event_log_reader_next(void* reader, const char** payload, uint32_t* size, char* error, size_t error_size) {
+  try {
+    return static_cast<EventLogReader*>(reader)->next(payload, size);
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return -1;
+  }
+}
+
+int event_log_reader_seek(void* reader, uint64_t offset, char* error, size_t error_size) {
+  try {
+    static_cast<EventLogReader*>(reader)->seek(offset);
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+int event_log_reader_finished(void* reader) {
+  return static_cast<EventLogReader*>(reader)->is_finished() ? 1 : 0;
+}
+
+// Reads the block index and returns the number of blocks, the entries are
+// then fetched with event_log_reader_index_entry.
+int64_t event_log_reader_index(void* reader, char* error, size_t error_size) {
+  try {
+    return static_cast<int64_t>(static_cast<EventLogReader*>(reader)->read_index().size());
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return -1;
+  }
+}
+
+void event_log_reader_index_entry(void* reader, size_t position, uint64_t* offset, uint32_t* event_count,
+                                  const char** first_key, size_t* first_key_size, const char** last_key,
+                                  size_t* last_key_size, const char** tag, size_t* tag_size) {
+  const auto& info = static_cast<EventLogReader*>(reader)->index_entry(position);
+  *offset = info.offset;
+  *event_count = info.event_count;
+  *first_key = info.first_key.data();
+  *first_key_size = info.first_key.size();
+  *last_key = info.last_key.data();
+  *last_key_size = info.last_key.size();
+  *tag = info.tag.data();
+  *tag_size = info.tag.size();
+}
+
+// Returns 1 and the key of the last written event, 0 if there are no
+// events yet, -1 on error.
+int event_log_reader_last_key(void* reader, const char** key, size_t* key_size, char* error, size_t error_size) {
+  try {
+    const std::string* last_key = static_cast<EventLogReader*>(reader)->read_last_key();
+    if (last_key == nullptr) {
+      return 0;
+    }
+    *key = last_key->data();
+    *key_size = last_key->size();
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return -1;
+  }
+}
+
+int event_log_compact(const char* src_path, const char* dst_path, int codec, size_t block_size, char* error,
+                      size_t error_size) {
+  try {
+    compact_event_log(src_path, dst_path, static_cast<uint8_t>(codec), block_size);
+    return 1;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return 0;
+  }
+}
+
+void* dir_watcher_open(const char* path, char* error, size_t error_size) {
+  try {
+    return new DirWatcher(path);
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return nullptr;
+  }
+}
+
+void dir_watcher_close(void* watcher) {
+  delete static_cast<DirWatcher*>(watcher);
+}
+
+// Returns 1 on changes, 0 on timeout, -1 on error.
+int dir_watcher_wait(void* watcher, int timeout_ms, char* error, size_t error_size) {
+  try {
+    return static_cast<DirWatcher*>(watcher)->wait(timeout_ms) ? 1 : 0;
+  } catch (const std::exception& e) {
+    std::snprintf(error, error_size, "%s", e.what());
+    return -1;
+  }
+}
+
+PyObject* event_log_encode(PyObject* transaction_id, PyObject* db_name, PyObject* table_name,
+                           PyObject* records, PyObject* is_removal) {
+  return encode_log_event(transaction_id, db_name, table_name, records, is_removal);
+}
+
+PyObject* event_log_decode(const char* data, size_t size) {
+  return decode_log_event(data, size);
+}
+
+// Decodes the next event where the reader has it (the file mapping or the
+// decompressed block), None if there is no complete block left yet.
+PyObject* event_log_reader_next_event(void* reader) {
+  const char* payload;
+  uint32_t size;
+  try {
+    if (!static_cast<EventLogReader*>(reader)->next(&payload, &size)) {
+      Py_RETURN_NONE;
+    }
+  } catch (const std::exception& e) {
+    PyErr_SetString(PyExc_OSError, e.what());
+    return nullptr;
+  }
+  return decode_log_event(payload, size);
+}
+
+int clickhouse_type_supported(const char* type) {
+  return clickhouse_native_type_supported(type) ? 1 : 0;
+}
+
+PyObject* clickhouse_encode_native(PyObject* records, PyObject* column_names, PyObject* column_types,
+                                   PyObject* versions) {
+  return encode_clickhouse_native(records, column_names, column_types, versions);
+}
+
+void* staging_table_create() {
+  return new StagingTable();
+}
+
+void staging_table_free(void* table) {
+  delete static_cast<StagingTable*>(table);
+}
+
+Py_ssize_t staging_table_apply(void* table, PyObject* records, Py_ssize_t key_index, int is_removal,
+                               uint64_t first_version) {
+  return static_cast<StagingTable*>(table)->apply(records, key_index, is_removal != 0, first_version);
+}
+
+PyObject* staging_table_take(void* table) {
+  return static_cast<StagingTable*>(table)->take();
+}
+
+size_t staging_table_insert_count(void* table) {
+  return static_cast<StagingTable*>(table)->insert_count();
+}
+
+size_t staging_table_delete_count(void* table) {
+  return static_cast<StagingTable*>(table)->delete_count();
+}
+
+unsigned long event_codec_python_version() {
+  return PY_VERSION_HEX;
+}
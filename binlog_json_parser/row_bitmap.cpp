@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cstring>
+
+#include "row_bitmap.h"
+
+
+static uint64_t load_word(const uint8_t* bitmap, size_t word_idx, size_t total_bytes) {
+  size_t offset = word_idx * 8;
+  size_t available = std::min(total_bytes - offset, static_cast<size_t>(8));
+  uint64_t word = 0;
+  std::memcpy(&word, bitmap + offset, available);
+  // bitmaps are little endian: bit N lives in byte N / 8
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+size_t bitmap_count(const uint8_t* bitmap, size_t len) {
+  size_t result = 0;
+  size_t words = len / 8;
+  for (size_t i = 0; i < words; i++) {
+    result += __builtin_popcountll(load_word(bitmap, i, len));
+  }
+  for (size_t i = words * 8; i < len; i++) {
+    result += __builtin_popcount(bitmap[i]);
+  }
+  return result;
+}
+
+size_t expand_row_bitmaps(const uint8_t* cols_bitmap, const uint8_t* null_bitmap,
+                          size_t column_count, uint8_t* states) {
+  std::memset(states, ROW_COLUMN_MISSING, column_count);
+
+  size_t total_bytes = (column_count + 7) / 8;
+  size_t words = (column_count + 63) / 64;
+  size_t null_idx = 0;
+  size_t present = 0;
+
+  for (size_t w = 0; w < words; w++) {
+    uint64_t cols = load_word(cols_bitmap, w, total_bytes);
+    size_t tail_bits = column_count - w * 64;
+    if (tail_bits < 64) {
+      cols &= (uint64_t(1) << tail_bits) - 1;
+    }
+    while (cols) {
+      size_t column = w * 64 + __builtin_ctzll(cols);
+      cols &= cols - 1;
+      bool is_null = null_bitmap[null_idx / 8] & (1 << (null_idx % 8));
+      states[column] = is_null ? ROW_COLUMN_NULL : ROW_COLUMN_PRESENT;
+      present += !is_null;
+      null_idx++;
+    }
+  }
+  return present;
+}
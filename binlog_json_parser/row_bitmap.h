@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint8_t ROW_COLUMN_PRESENT = 0x0;
+constexpr uint8_t ROW_COLUMN_NULL = 0x1;
+constexpr uint8_t ROW_COLUMN_MISSING = 0x2;
+
+size_t bitmap_count(const uint8_t* bitmap, size_t len);
+
+// Expands the columns-present bitmap and the row null bitmap into one state
+// byte per column (ROW_COLUMN_*). Only bits set in the columns-present bitmap
+// are visited, so sparse MINIMAL row images cost O(present columns).
+// Returns the number of columns that carry a value.
+size_t expand_row_bitmaps(const uint8_t* cols_bitmap, const uint8_t* null_bitmap,
+                          size_t column_count, uint8_t* states);
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "staging_table.h"
+
+
+constexpr size_t STAGING_TABLE_INITIAL_BUCKETS = 64;
+// bucket arrays up to this size are kept for the next batch
+constexpr size_t STAGING_TABLE_KEPT_BUCKETS = 1 << 16;
+
+static uint64_t mix_hash(uint64_t value) {
+  // splitmix64 finalizer
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ULL;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebULL;
+  value ^= value >> 31;
+  return value;
+}
+
+static uint64_t hash_bytes(const char* data, size_t size) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return mix_hash(hash);
+}
+
+StagingTable::~StagingTable() {
+  clear();
+}
+
+bool StagingTable::make_key(PyObject* key_object, Key& key) {
+  if (PyLong_Check(key_object)) {
+    int overflow = 0;
+    long long value = PyLong_AsLongLongAndOverflow(key_object, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+      return false;
+    }
+    if (!overflow) {
+      key.kind = KeyKind::INT;
+      key.int_value = value;
+      key.hash = mix_hash(static_cast<uint64_t>(value));
+      return true;
+    }
+  } else if (PyUnicode_Check(key_object)) {
+    Py_ssize_t size;
+    key.data = PyUnicode_AsUTF8AndSize(key_object, &size);
+    if (!key.data) {
+      return false;
+    }
+    key.kind = KeyKind::STR;
+    key.size = static_cast<size_t>(size);
+    key.hash = hash_bytes(key.data, key.size);
+    return true;
+  } else if (PyBytes_Check(key_object)) {
+    key.kind = KeyKind::BYTES;
+    key.data = PyBytes_AS_STRING(key_object);
+    key.size = static_cast<size_t>(PyBytes_GET_SIZE(key_object));
+    key.hash = hash_bytes(key.data, key.size);
+    return true;
+  }
+
+  Py_hash_t hash = PyObject_Hash(key_object);
+  if (hash == -1 && PyErr_Occurred()) {
+    return false;
+  }
+  key.kind = KeyKind::OBJECT;
+  key.hash = mix_hash(static_cast<uint64_t>(hash));
+  return true;
+}
+
+Py_ssize_t StagingTable::find(const Key& key, PyObject* key_object, size_t& bucket) {
+  size_t mask = buckets.size() - 1;
+  for (size_t position = key.hash & mask;; position = (position + 1) & mask) {
+    uint32_t slot_number = buckets[position];
+    if (slot_number == 0) {
+      bucket = position;
+      return -1;
+    }
+    const Slot& slot = slots[slot_number - 1];
+    if (slot.key.hash != key.hash || slot.key.kind != key.kind) {
+      continue;
+    }
+    switch (key.kind) {
+      case KeyKind::INT:
+        if (slot.key.int_value == key.int_value) {
+          return slot_number - 1;
+        }
+        break;
+      case KeyKind::STR:
+      case KeyKind::BYTES:
+        if (slot.key.size == key.size && std::memcmp(slot.key.data, key.data, key.size) == 0) {
+          return slot_number - 1;
+        }
+        break;
+      case KeyKind::OBJECT: {
+        int equal = PyObject_RichCompareBool(slot.key_object, key_object, Py_EQ);
+        if (equal < 0) {
+          return -2;
+        }
+        if (equal) {
+          return slot_number - 1;
+        }
+        break;
+      }
+    }
+  }
+}
+
+void StagingTable::grow() {
+  size_t size = buckets.empty() ? STAGING_TABLE_INITIAL_BUCKETS : buckets.size() * 2;
+  buckets.assign(size, 0);
+  size_t mask = size - 1;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    size_t position = slots[i].key.hash & mask;
+    while (buckets[position] != 0) {
+      position = (position + 1) & mask;
+    }
+    buckets[position] = static_cast<uint32_t>(i + 1);
+  }
+}
+
+Py_ssize_t StagingTable::apply(PyObject* records, Py_ssize_t key_index, bool is_removal, uint64_t first_version) {
+  PyObject* records_fast = PySequence_Fast(records, "records must be a sequence");
+  if (!records_fast) {
+    return -1;
+  }
+  Py_ssize_t record_count = PySequence_Fast_GET_SIZE(records_fast);
+  PyObject** items = PySequence_Fast_ITEMS(records_fast);
+  Py_ssize_t added = 0;
+
+  for (Py_ssize_t i = 0; i < record_count; ++i) {
+    PyObject* record = items[i];
+    uint64_t version = first_version + static_cast<uint64_t>(i);
+    PyObject* key_object = PySequence_GetItem(record, key_index);
+    if (!key_object) {
+      Py_DECREF(records_fast);
+      return -1;
+    }
+    Key key;
+    size_t bucket;
+    Py_ssize_t slot_index = -2;
+    // at most half of the buckets are used
+    if ((slots.size() + 1) * 2 > buckets.size()) {
+      if (slots.size() >= std::numeric_limits<uint32_t>::max() / 2) {
+        PyErr_SetString(PyExc_OverflowError, "too many staged keys");
+      } else {
+        grow();
+      }
+    }
+    if (!PyErr_Occurred() && make_key(key_object, key)) {
+      slot_index = find(key, key_object, bucket);
+    }
+    if (slot_index == -2) {
+      Py_DECREF(key_object);
+      Py_DECREF(records_fast);
+      return -1;
+    }
+
+    if (slot_index == -1) {
+      if (is_removal) {
+        ++deleted_count;
+      } else {
+        Py_INCREF(record);
+      }
+      slots.push_back(Slot{key, key_object, is_removal ? nullptr : record, version});
+      buckets[bucket] = static_cast<uint32_t>(slots.size());
+      ++added;
+      continue;
+    }
+
+    Py_DECREF(key_object);
+    Slot& slot = slots[slot_index];
+    slot.version = version;
+    if (is_removal) {
+      if (slot.record) {
+        Py_CLEAR(slot.record);
+        ++deleted_count;
+      }
+    } else {
+      if (!slot.record) {
+        --deleted_count;
+      }
+      Py_INCREF(record);
+      Py_XSETREF(slot.record, record);
+    }
+  }
+
+  Py_DECREF(records_fast);
+  return added;
+}
+
+PyObject* StagingTable::take() {
+  Py_ssize_t record_count = static_cast<Py_ssize_t>(insert_count());
+  Py_ssize_t key_count = static_cast<Py_ssize_t>(deleted_count);
+  PyObject* records = PyList_New(record_count);
+  PyObject* keys = PyList_New(key_count);
+  PyObject* record_versions = PyBytes_FromStringAndSize(nullptr, record_count * sizeof(uint64_t));
+  PyObject* key_versions = PyBytes_FromStringAndSize(nullptr, key_count * sizeof(uint64_t));
+  if (!records || !keys || !record_versions || !key_versions) {
+    Py_XDECREF(records);
+    Py_XDECREF(keys);
+    Py_XDECREF(record_versions);
+    Py_XDECREF(key_versions);
+    return nullptr;
+  }
+  char* record_versions_data = PyBytes_AS_STRING(record_versions);
+  char* key_versions_data = PyBytes_AS_STRING(key_versions);
+  Py_ssize_t record_position = 0;
+  Py_ssize_t key_position = 0;
+  for (Slot& slot : slots) {
+    // the lists take over the references
+    if (slot.record) {
+      std::memcpy(record_versions_data + record_position * sizeof(uint64_t), &slot.version, sizeof(uint64_t));
+      PyList_SET_ITEM(records, record_position++, slot.record);
+      slot.record = nullptr;
+    } else {
+      std::memcpy(key_versions_data + key_position * sizeof(uint64_t), &slot.version, sizeof(uint64_t));
+      PyList_SET_ITEM(keys, key_position++, slot.key_object);
+      slot.key_object = nullptr;
+    }
+  }
+  clear();
+  return Py_BuildValue("(NNNN)", records, record_versions, keys, key_versions);
+}
+
+void StagingTable::clear() {
+  for (Slot& slot : slots) {
+    Py_XDECREF(slot.key_object);
+    Py_XDECREF(slot.record);
+  }
+  deleted_count = 0;
+  if (buckets.size() > STAGING_TABLE_KEPT_BUCKETS) {
+    // after a burst, don't hold on to its memory
+    slots = {};
+    buckets = {};
+    return;
+  }
+  slots.clear();
+  std::fill(buckets.begin(), buckets.end(), 0);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Records of one table waiting for upload, deduplicated by primary key: an
+// open addressing hash map (linear probing) from the key to a slot with the
+// last record staged for it, or none once the key was deleted, and the
+// ClickHouse `_version` of that record or delete. Updates of a staged key
+// replace the record in place.
+//
+// Keys of type int (64 bit), str and bytes are hashed and compared
+// natively, other hashable keys through python like a dict does.
+//
+// All calls need the GIL (ctypes.PyDLL), errors return with a python
+// exception set.
+class StagingTable {
+public:
+  StagingTable() = default;
+  ~StagingTable();
+
+  StagingTable(const StagingTable&) = delete;
+  StagingTable& operator=(const StagingTable&) = delete;
+
+  // Stages the records (sequences, the key at key_index) as inserted or
+  // updated, or as deleted, with the versions first_version, first_version
+  // + 1, ... Returns how many keys weren't staged before, -1 on error (the
+  // records before the failed one stay staged).
+  Py_ssize_t apply(PyObject* records, Py_ssize_t key_index, bool is_removal, uint64_t first_version);
+
+  // (records, their versions, deleted keys, their versions): lists in the
+  // order the keys were first staged, the versions as bytes of native
+  // uint64 (the data of a ClickHouse UInt64 column). The table is empty
+  // afterwards.
+  PyObject* take();
+
+  size_t insert_count() const { return slots.size() - deleted_count; }
+  size_t delete_count() const { return deleted_count; }
+
+private:
+  enum class KeyKind : uint8_t { INT, STR, BYTES, OBJECT };
+
+  struct Key {
+    KeyKind kind;
+    uint64_t hash;
+    int64_t int_value = 0;
+    const char* data = nullptr;
+    size_t size = 0;
+  };
+
+  struct Slot {
+    Key key;  // data points into key_object
+    PyObject* key_object;  // owned
+    PyObject* record;  // owned, nullptr when deleted
+    uint64_t version;
+  };
+
+  bool make_key(PyObject* key_object, Key& key);
+  // The slot of the key, -1 if it isn't staged, -2 on error. `bucket` is
+  // where the key is or would be inserted.
+  Py_ssize_t find(const Key& key, PyObject* key_object, size_t& bucket);
+  void grow();
+  void clear();
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> buckets;  // slot index + 1, 0 when empty
+  size_t deleted_count = 0;
+};
@@ -1,4 +1,6 @@
+import bisect
 import pickle
+import shutil
 import struct
 import time
 import os
@@ -7,11 +9,23 @@ import json
 from logging import getLogger
 from dataclasses import dataclass
 from pymysqlreplication import BinLogStreamReader
+from pymysqlreplication.binlogfilestream import BinLogFileStreamReader, get_binlog_files
 from pymysqlreplication.row_event import (
     DeleteRowsEvent,
     UpdateRowsEvent,
     WriteRowsEvent,
 )
+from pymysqlreplication.cpp_accelerated import (
+    NativeEventLogReader,
+    NativeEventLogWriter,
+    NativeDirWatcher,
+    EVENT_LOG_MAGIC,
+    EVENT_LOG_CODECS,
+    check_event_codec_python_version,
+    cpp_event_log_codec_available,
+    cpp_encode_event,
+    cpp_compact_event_log,
+)
 from pymysql.err import OperationalError
 
 from config import MysqlSettings, BinlogReplicatorSettings
@@ -19,6 +33,8 @@ from config import MysqlSettings, BinlogReplicatorSettings
 
 logger = getLogger(__name__)
 
+check_event_codec_python_version()
+
 
 @dataclass
 class LogEvent:
@@ -29,33 +45,73 @@ class LogEvent:
     is_removal: bool = False
 
 
+def transaction_key(transaction_id) -> bytes:
+    # keys compare bytewise like the (file_name, log_pos) tuples do
+    file_name, log_pos = transaction_id
+    return file_name.encode() + b'\0' + log_pos.to_bytes(8, 'big')
+
+
+def transaction_from_key(key: bytes):
+    return key[:-9].decode(), int.from_bytes(key[-8:], 'big')
+
+
+def transaction_version(transaction_id, record_count=0) -> int:
+    """ClickHouse _version of the first record of the event of the
+    transaction (a binlog rows event with record_count records), the next
+    records of the event take the next versions. Versions grow with the
+    binlog position, whoever computes them and in whatever order.
+
+    (binlog file number << 32) + end position of the event - record_count
+    + 1: a rows event is longer in bytes than its record count, so the
+    versions of its records stay above the end of the previous event.
+    Before the first event (None) the version is 0."""
+    if transaction_id is None:
+        return 0
+    file_name, log_pos = transaction_id
+    file_number = int(file_name.rsplit('.', 1)[-1])
+    return (file_number << 32) + log_pos - record_count + 1
+
+
+# With shared_log the events of all dbs go to one sequence of files in this
+# directory, every block is tagged with the name of its db
+SHARED_LOG_NAME = '.shared'
+
+
 class FileWriter:
-    FLUSH_INTERVAL = 10
 
-    def __init__(self, file_path):
+    def __init__(self, file_path, compression='lz4', block_size=1 << 20, tagged=False):
+        self.file_num = int(os.path.basename(file_path).split('.')[0])
         self.num_records = 0
-        self.file = open(file_path, 'wb')
-        self.last_flush_time = 0
+        self.tagged = tagged
+        self.writer = NativeEventLogWriter(file_path, compression, block_size)
 
     def close(self):
-        self.file.close()
+        self.writer.close()
+
+    def flush(self):
+        self.writer.flush()
+
+    def sync(self):
+        self.writer.sync()
 
     def write_event(self, log_event):
-        data = pickle.dumps(log_event)
-        data_size = len(data)
-        data = struct.pack('>I', data_size) + data
-        self.file.write(data)
-        curr_time = time.time()
-        if curr_time - self.last_flush_time > FileWriter.FLUSH_INTERVAL:
-            self.file.flush()
+        self.writer.append(cpp_encode_event(
+            log_event.transaction_id,
+            log_event.db_name,
+            log_event.table_name,
+            log_event.records,
+            log_event.is_removal,
+        ), transaction_key(log_event.transaction_id), log_event.db_name.encode() if self.tagged else b'')
         self.num_records += len(log_event.records)
 
 
-class FileReader:
-    def __init__(self, file_path):
-        self.file = open(file_path, 'rb')
+class PickleFileReader:
+    """Reads files written before the event log format: pickled events
+    behind a 4 byte size"""
+
+    def __init__(self, file):
+        self.file = file
         self.current_buffer = b''
-        self.file_num = int(os.path.basename(file_path).split('.')[0])
 
     def close(self):
         self.file.close()
@@ -85,6 +141,97 @@ class FileReader:
         return event
 
 
+class FileReader:
+    """Reads the events of one db, in a shared log file the ones tagged
+    with `tag`"""
+
+    def __init__(self, file_path, tag: bytes | None = None):
+        self.file_num = int(os.path.basename(file_path).split('.')[0])
+        self.tag = tag
+        with open(file_path, 'rb') as f:
+            magic = f.read(len(EVENT_LOG_MAGIC))
+        # the writer creates files together with the magic bytes,
+        # a shorter file is a new one we see before its header
+        if magic == EVENT_LOG_MAGIC or len(magic) < len(EVENT_LOG_MAGIC):
+            self.reader = NativeEventLogReader(file_path, tag)
+            self.pickle_reader = None
+        else:
+            self.reader = None
+            self.pickle_reader = PickleFileReader(open(file_path, 'rb'))
+
+    def close(self):
+        if self.reader is not None:
+            self.reader.close()
+        if self.pickle_reader is not None:
+            self.pickle_reader.close()
+
+    def get_first_transaction(self):
+        if self.pickle_reader is not None:
+            first_event = self.pickle_reader.read_next_event()
+            return first_event.transaction_id if first_event is not None else None
+        index = self.read_index()
+        if not index:
+            return None
+        return transaction_from_key(index[0][2])
+
+    def get_last_transaction(self):
+        if self.pickle_reader is not None:
+            last_transaction = None
+            while True:
+                event = self.pickle_reader.read_next_event()
+                if event is None:
+                    return last_transaction
+                last_transaction = event.transaction_id
+        last_key = self.reader.read_last_key()
+        if last_key is None:
+            return None
+        return transaction_from_key(last_key)
+
+    def seek_before_transaction(self, transaction_id):
+        """Moves to the block the first event with transaction_id can be in,
+        the events before it still have to be skipped.
+        Files without an index are read from the start."""
+        if self.pickle_reader is not None:
+            return
+        index = self.read_index()
+        position = bisect.bisect_left([entry[2] for entry in index], transaction_key(transaction_id))
+        if position > 0:
+            self.reader.seek(index[position - 1][0])
+
+    def read_index(self):
+        index = self.reader.read_index()
+        if self.tag is None:
+            return index
+        return [entry for entry in index if entry[4] == self.tag]
+
+    def get_db_transactions(self) -> dict:
+        """{db_name: [first transaction, last transaction]} of a shared log file"""
+        result = {}
+        for _, _, first_key, last_key, tag in self.reader.read_index():
+            db_name = tag.decode()
+            if db_name not in result:
+                result[db_name] = [transaction_from_key(first_key), None]
+            result[db_name][1] = transaction_from_key(last_key)
+        return result
+
+    @property
+    def finished(self) -> bool:
+        """All events of the file were read and the writer finished it.
+        Pickle files predate the native writer, they are all complete."""
+        if self.pickle_reader is not None:
+            return True
+        return self.reader.finished
+
+    def read_next_event(self) -> LogEvent | None:
+        if self.pickle_reader is not None:
+            return self.pickle_reader.read_next_event()
+
+        event = self.reader.next_event()
+        if event is None:
+            return None
+        return LogEvent(*event)
+
+
 def get_existing_file_nums(data_dir, db_name):
     db_path = os.path.join(data_dir, db_name)
     if not os.path.exists(db_path):
@@ -99,58 +246,200 @@ def get_file_name_by_num(data_dir, db_name, file_num):
     return os.path.join(data_dir, db_name, f'{file_num}.bin')
 
 
+class FileCatalog:
+    """Event files of a db, kept in {data_dir}/{db}/catalog.json so that
+    the directory doesn't have to be listed and the files opened to find
+    a transaction. Only the binlog replicator writes it (atomically, on
+    file rotation), readers reload it when it changes.
+
+    Entries of completed files have their first/last transaction, size and
+    record count, the entry of the file being written only its number.
+
+    The catalog of the shared log (db_name SHARED_LOG_NAME) also has the
+    first/last transaction of every db in a completed file under 'dbs'.
+    A reader of one db (view_db) only sees the completed files with events
+    of that db, with the transactions of that db."""
+
+    FILE_NAME = 'catalog.json'
+
+    def __init__(self, data_dir, db_name, view_db: str | None = None):
+        self.data_dir = data_dir
+        self.db_name = db_name
+        self.view_db = view_db
+        self.file_path = os.path.join(data_dir, db_name, FileCatalog.FILE_NAME)
+        self.entries: list[dict] = []
+        self.loaded_version = None
+
+    def refresh(self):
+        try:
+            st = os.stat(self.file_path)
+        except FileNotFoundError:
+            # not written yet, or the files predate the catalog
+            existing_file_nums = get_existing_file_nums(self.data_dir, self.db_name)
+            self.entries = [{'num': file_num} for file_num in existing_file_nums]
+            self.loaded_version = None
+            return
+        version = (st.st_ino, st.st_mtime_ns, st.st_size)
+        if version == self.loaded_version:
+            return
+        with open(self.file_path, 'rt') as f:
+            entries = json.load(f)['files']
+        for entry in entries:
+            for field in ('first_transaction', 'last_transaction'):
+                if entry.get(field) is not None:
+                    entry[field] = tuple(entry[field])
+            for db_name, transactions in entry.get('dbs', {}).items():
+                entry['dbs'][db_name] = [tuple(transaction) for transaction in transactions]
+        if self.view_db is not None:
+            entries = [self.get_db_view(entry) for entry in entries]
+            entries = [entry for entry in entries if entry is not None]
+        self.entries = entries
+        self.loaded_version = version
+
+    def get_db_view(self, entry) -> dict | None:
+        if 'dbs' not in entry:
+            return entry
+        transactions = entry['dbs'].get(self.view_db)
+        if transactions is None:
+            return None
+        return {'num': entry['num'], 'first_transaction': transactions[0], 'last_transaction': transactions[1]}
+
+    def file_nums(self) -> list[int]:
+        return [entry['num'] for entry in self.entries]
+
+    def get_entry(self, file_num) -> dict | None:
+        for entry in reversed(self.entries):
+            if entry['num'] == file_num:
+                return entry
+        return None
+
+    def load_for_writing(self):
+        """Catches up with files the previous writer didn't record, they
+        are all complete since a writer always starts a new file"""
+        self.refresh()
+        existing_file_nums = get_existing_file_nums(self.data_dir, self.db_name)
+        entries = {entry['num']: entry for entry in self.entries}
+        self.entries = [entries.get(file_num, {'num': file_num}) for file_num in existing_file_nums]
+        for entry in self.entries:
+            if 'last_transaction' not in entry:
+                self.describe_file(entry)
+        self.save()
+
+    def describe_file(self, entry, records=None):
+        file_name = get_file_name_by_num(self.data_dir, self.db_name, entry['num'])
+        file_reader = FileReader(file_name)
+        entry['first_transaction'] = file_reader.get_first_transaction()
+        file_reader.close()
+        file_reader = FileReader(file_name)
+        entry['last_transaction'] = file_reader.get_last_transaction()
+        if self.db_name == SHARED_LOG_NAME:
+            entry['dbs'] = file_reader.get_db_transactions()
+        file_reader.close()
+        entry['size'] = os.path.getsize(file_name)
+        entry['records'] = records
+
+    def complete_file(self, file_num, records):
+        self.describe_file(self.get_entry(file_num), records)
+
+    def add_file(self, file_num):
+        self.entries.append({'num': file_num})
+        self.save()
+
+    def save(self):
+        data = json.dumps({'files': self.entries})
+        with open(self.file_path + '.tmp', 'wt') as f:
+            f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+        os.rename(self.file_path + '.tmp', self.file_path)
+
+
 class DataReader:
     def __init__(self, replicator_settings: BinlogReplicatorSettings, db_name: str):
         self.data_dir = replicator_settings.data_dir
         self.db_name = db_name
+        if replicator_settings.shared_log:
+            # the db dir only has the db replicator state then
+            os.makedirs(os.path.join(self.data_dir, db_name), exist_ok=True)
+            self.log_name = SHARED_LOG_NAME
+            self.tag = db_name.encode()
+            self.catalog = FileCatalog(self.data_dir, SHARED_LOG_NAME, view_db=db_name)
+        else:
+            self.log_name = db_name
+            self.tag = None
+            self.catalog = FileCatalog(self.data_dir, db_name)
         self.current_file_reader: FileReader | None = None
+        self.watcher: NativeDirWatcher | None = None
+
+    def wait_for_events(self, timeout):
+        """Blocks until the writer creates or appends to a file of the db,
+        or timeout seconds pass. Returns False on timeout."""
+        if self.watcher is None:
+            log_path = os.path.join(self.data_dir, self.log_name)
+            os.makedirs(log_path, exist_ok=True)
+            self.watcher = NativeDirWatcher(log_path)
+            # changes before the watcher existed were missed
+            return True
+        return self.watcher.wait(timeout)
 
     def get_last_transaction_id(self):
-        last_file_name = self.get_last_file_name()
-        if last_file_name is None:
-            return None
-        file_reader = FileReader(file_path=last_file_name)
-        last_transaction_id = None
-        while True:
-            event = file_reader.read_next_event()
-            if event is None:
-                break
-            last_transaction_id = event.transaction_id
-        file_reader.close()
-        return last_transaction_id
+        self.catalog.refresh()
+        # the last file may have been created without events written yet
+        for file_num in reversed(self.catalog.file_nums()):
+            entry = self.catalog.get_entry(file_num)
+            if 'last_transaction' in entry:
+                if entry['last_transaction'] is not None:
+                    return entry['last_transaction']
+                continue
+            file_reader = FileReader(get_file_name_by_num(self.data_dir, self.log_name, file_num), self.tag)
+            last_transaction_id = file_reader.get_last_transaction()
+            file_reader.close()
+            if last_transaction_id is not None:
+                return last_transaction_id
+        return None
 
     def get_last_file_name(self):
-        existing_file_nums = get_existing_file_nums(self.data_dir, self.db_name)
+        self.catalog.refresh()
+        existing_file_nums = self.catalog.file_nums()
         if existing_file_nums:
             last_file_num = max(existing_file_nums)
             file_name = f'{last_file_num}.bin'
-            file_name = os.path.join(self.data_dir, self.db_name, file_name)
+            file_name = os.path.join(self.data_dir, self.log_name, file_name)
             return file_name
         return None
 
     def get_first_transaction_in_file(self, file_num):
-        file_name = get_file_name_by_num(self.data_dir, self.db_name, file_num)
-        file_reader = FileReader(file_name)
-        first_event = file_reader.read_next_event()
-        if first_event is None:
-            return None
-        return first_event.transaction_id
+        entry = self.catalog.get_entry(file_num)
+        if entry is not None and 'first_transaction' in entry:
+            return entry['first_transaction']
+        file_name = get_file_name_by_num(self.data_dir, self.log_name, file_num)
+        file_reader = FileReader(file_name, self.tag)
+        first_transaction = file_reader.get_first_transaction()
+        file_reader.close()
+        return first_transaction
 
     def get_file_with_transaction(self, existing_file_nums, transaction_id):
-        matching_file_num = None
-        prev_file_num = None
-        for file_num in existing_file_nums:
-            file_first_transaction = self.get_first_transaction_in_file(file_num)
-            if file_first_transaction > transaction_id:
-                matching_file_num = prev_file_num
-                break
-            prev_file_num = file_num
-        if matching_file_num is None:
-            matching_file_num = existing_file_nums[-1]
-        return matching_file_num
+        # files hold increasing transactions, binary search for the last
+        # file starting at or before transaction_id
+        def starts_after(file_num):
+            first_transaction = self.get_first_transaction_in_file(file_num)
+            # a file without events yet only gets later transactions
+            return first_transaction is None or first_transaction > transaction_id
+
+        low, high = 0, len(existing_file_nums)
+        while low < high:
+            middle = (low + high) // 2
+            if starts_after(existing_file_nums[middle]):
+                high = middle
+            else:
+                low = middle + 1
+        if low == 0:
+            return existing_file_nums[-1]
+        return existing_file_nums[low - 1]
 
     def set_position(self, transaction_id):
-        existing_file_nums = get_existing_file_nums(self.data_dir, self.db_name)
+        self.catalog.refresh()
+        existing_file_nums = self.catalog.file_nums()
 
         if transaction_id is None:
             # todo: handle empty files case
@@ -160,17 +449,18 @@ class DataReader:
                 return
 
             matching_file_num = existing_file_nums[0]
-            file_name = get_file_name_by_num(self.data_dir, self.db_name, matching_file_num)
-            self.current_file_reader = FileReader(file_name)
+            file_name = get_file_name_by_num(self.data_dir, self.log_name, matching_file_num)
+            self.current_file_reader = FileReader(file_name, self.tag)
             logger.info(f'set position to the first file {file_name}')
             return
 
         matching_file_num = self.get_file_with_transaction(existing_file_nums, transaction_id)
 
-        file_name = get_file_name_by_num(self.data_dir, self.db_name, matching_file_num)
+        file_name = get_file_name_by_num(self.data_dir, self.log_name, matching_file_num)
         logger.info(f'set position to {file_name}')
 
-        self.current_file_reader = FileReader(file_name)
+        self.current_file_reader = FileReader(file_name, self.tag)
+        self.current_file_reader.seek_before_transaction(transaction_id)
         while True:
             event = self.current_file_reader.read_next_event()
             if event is None:
@@ -182,15 +472,30 @@ class DataReader:
                 break
         raise Exception(f'transaction {transaction_id} not found in {file_name}')
 
+    def is_file_complete(self, file_reader: FileReader) -> bool:
+        """No more events are written to the file: its footer was read, or
+        the catalog has it completed. A writer that stopped without
+        finishing its file leaves it without a footer, the next writer
+        completes it in the catalog before it starts a new file."""
+        if file_reader.finished:
+            return True
+        self.catalog.refresh()
+        if file_reader.file_num not in self.catalog.file_nums():
+            # a completed file of the shared log without events of the db
+            # (or one the retention already removed)
+            return True
+        return 'last_transaction' in self.catalog.get_entry(file_reader.file_num)
+
     def read_next_event(self) -> LogEvent | None:
         if self.current_file_reader is None:
             # no file reader - try to read from the beginning
-            existing_file_nums = get_existing_file_nums(self.data_dir, self.db_name)
+            self.catalog.refresh()
+            existing_file_nums = self.catalog.file_nums()
             if not existing_file_nums:
                 return None
             file_num = existing_file_nums[0]
-            file_name = get_file_name_by_num(self.data_dir, self.db_name, file_num)
-            self.current_file_reader = FileReader(file_name)
+            file_name = get_file_name_by_num(self.data_dir, self.log_name, file_num)
+            self.current_file_reader = FileReader(file_name, self.tag)
             return self.read_next_event()
 
         result = self.current_file_reader.read_next_event()
@@ -198,34 +503,101 @@ class DataReader:
         if result is None:
             # no result in current file - check if new file available
             next_file_num = self.current_file_reader.file_num + 1
-            next_file_path = get_file_name_by_num(self.data_dir, self.db_name, next_file_num)
+            next_file_path = get_file_name_by_num(self.data_dir, self.log_name, next_file_num)
             if not os.path.exists(next_file_path):
                 return None
+            # the writer only writes the last block of a file when it
+            # finishes it, which can happen after the next file is there
+            if not self.is_file_complete(self.current_file_reader):
+                return None
+            result = self.current_file_reader.read_next_event()
+            if result is not None:
+                return result
             logger.debug(f'switching to next file {next_file_path}')
-            self.current_file_reader = FileReader(next_file_path)
+            self.current_file_reader = FileReader(next_file_path, self.tag)
             return self.read_next_event()
 
         return result
 
 
+def sync_dir(dir_path):
+    dir_fd = os.open(dir_path, os.O_RDONLY)
+    try:
+        os.fsync(dir_fd)
+    finally:
+        os.close(dir_fd)
+
+
 class DataWriter:
+    """Events are buffered in memory and written in blocks, when a block
+    is full, flush_interval passed or on flush().
+
+    sync() is the group commit: a single fdatasync per file makes all
+    events written since the previous sync durable. The replicator syncs
+    before saving its state, after a crash it resumes from the saved
+    position, so events past it can be lost and are read from the binlog
+    again, events before it are on disk.
+
+    With shared_log all dbs write to the files of SHARED_LOG_NAME, which
+    takes a single file (and fdatasync) for any number of dbs. Every db
+    has a pending block of its own there, up to compression_block_size."""
+
     def __init__(self, replicator_settings: BinlogReplicatorSettings):
         self.data_dir = replicator_settings.data_dir
         if not os.path.exists(self.data_dir):
             os.mkdir(self.data_dir)
         self.records_per_file = replicator_settings.records_per_file
-        self.db_file_writers: dict[str, FileWriter] = {}  # db_name => FileWriter
+        self.compression = replicator_settings.compression
+        if self.compression not in EVENT_LOG_CODECS:
+            raise ValueError(f'unknown compression {self.compression}, use one of {list(EVENT_LOG_CODECS)}')
+        if not cpp_event_log_codec_available(self.compression):
+            logger.warning(f'{self.compression} compression is not built into the native library, using zlib')
+            self.compression = 'zlib'
+        self.compression_block_size = replicator_settings.compression_block_size
+        self.flush_interval = replicator_settings.flush_interval
+        self.fsync = replicator_settings.fsync
+        self.shared_log = replicator_settings.shared_log
+        self.last_flush_time = time.monotonic()
+        # keyed by db_name, or only SHARED_LOG_NAME with shared_log
+        self.db_file_writers: dict[str, FileWriter] = {}
+        self.db_catalogs: dict[str, FileCatalog] = {}
+        self.unsynced_dirs = set()
 
     def store_event(self, log_event: LogEvent):
         logger.debug(f'store event {log_event.transaction_id}')
-        file_writer = self.get_or_create_file_writer(log_event.db_name)
+        log_name = SHARED_LOG_NAME if self.shared_log else log_event.db_name
+        file_writer = self.get_or_create_file_writer(log_name)
         file_writer.write_event(log_event)
+        if time.monotonic() - self.last_flush_time >= self.flush_interval:
+            self.flush()
+
+    def flush(self):
+        # events only become visible to readers once their block is written
+        for file_writer in self.db_file_writers.values():
+            file_writer.flush()
+        self.last_flush_time = time.monotonic()
+
+    def sync(self):
+        if not self.fsync:
+            self.flush()
+            return
+        for file_writer in self.db_file_writers.values():
+            file_writer.sync()
+        # entries of newly created files
+        for dir_path in self.unsynced_dirs:
+            sync_dir(dir_path)
+        self.unsynced_dirs.clear()
+        self.last_flush_time = time.monotonic()
 
     def get_or_create_file_writer(self, db_name: str) -> FileWriter:
         file_writer = self.db_file_writers.get(db_name)
         if file_writer is not None:
             if file_writer.num_records >= self.records_per_file:
+                if self.fsync:
+                    # no sync() reaches it once it's closed
+                    file_writer.sync()
                 file_writer.close()
+                self.get_catalog(db_name).complete_file(file_writer.file_num, file_writer.num_records)
                 del self.db_file_writers[db_name]
                 file_writer = None
         if file_writer is None:
@@ -233,12 +605,26 @@ class DataWriter:
             self.db_file_writers[db_name] = file_writer
         return file_writer
 
+    def get_catalog(self, db_name: str) -> FileCatalog:
+        catalog = self.db_catalogs.get(db_name)
+        if catalog is None:
+            catalog = FileCatalog(self.data_dir, db_name)
+            catalog.load_for_writing()
+            self.db_catalogs[db_name] = catalog
+        return catalog
+
     def create_file_writer(self, db_name: str) -> FileWriter:
         next_free_file = self.get_next_file_name(db_name)
-        return FileWriter(next_free_file)
+        self.unsynced_dirs.add(os.path.dirname(next_free_file))
+        self.unsynced_dirs.add(self.data_dir)
+        file_writer = FileWriter(
+            next_free_file, self.compression, self.compression_block_size, tagged=db_name == SHARED_LOG_NAME,
+        )
+        self.get_catalog(db_name).add_file(file_writer.file_num)
+        return file_writer
 
     def get_next_file_name(self, db_name: str):
-        existing_file_nums = get_existing_file_nums(self.data_dir, db_name)
+        existing_file_nums = self.get_catalog(db_name).file_nums()
 
         last_file_num = 0
         if existing_file_nums:
@@ -250,6 +636,143 @@ class DataWriter:
         return new_file_name
 
 
+class FileRetention:
+    """Removes event files the db replicator of the db is done with: the
+    completed files that end before the last_processed_transaction in its
+    {data_dir}/{db}/state.pckl. The file with that transaction stays, the
+    reader positions itself on it. Files are dropped from the catalog
+    before they are removed, a reader that still has one open keeps
+    reading it.
+
+    A file of the shared log is removed once every db with events in it
+    is done with them. A db without a state yet (its db replicator hasn't
+    run, or is still in the initial replication) is at position zero and
+    keeps every file with its events.
+
+    Completed files can also be compacted: rewritten into bigger blocks
+    with compaction_codec and renamed over the original, readers see the
+    same events either way."""
+
+    DB_STATE_FILE_NAME = 'state.pckl'
+    COMPACT_FILES_PER_RUN = 10
+
+    def __init__(self, replicator_settings: BinlogReplicatorSettings, data_writer: DataWriter):
+        self.data_dir = replicator_settings.data_dir
+        self.interval = replicator_settings.retention_interval
+        self.archive_dir = replicator_settings.retention_archive_dir
+        self.compaction_codec = replicator_settings.compaction_codec
+        self.compaction_block_size = replicator_settings.compaction_block_size
+        if self.compaction_codec and self.compaction_codec not in EVENT_LOG_CODECS:
+            raise ValueError(f'unknown compaction codec {self.compaction_codec}')
+        if self.compaction_codec and not cpp_event_log_codec_available(self.compaction_codec):
+            raise ValueError(f'{self.compaction_codec} compression is not built into the native library')
+        self.data_writer = data_writer
+        self.last_run_time = time.time()
+
+    def run_if_required(self):
+        if not self.interval:
+            return
+        curr_time = time.time()
+        if curr_time - self.last_run_time < self.interval:
+            return
+        self.last_run_time = curr_time
+        self.run()
+
+    def run(self):
+        if self.data_writer.shared_log:
+            # the db dirs only have the state of the db replicators
+            log_names = [SHARED_LOG_NAME]
+        else:
+            log_names = os.listdir(self.data_dir)
+        for log_name in log_names:
+            if not os.path.isdir(os.path.join(self.data_dir, log_name)):
+                continue
+            catalog = self.data_writer.get_catalog(log_name)
+            self.remove_processed_files(log_name, catalog)
+            if self.compaction_codec:
+                self.compact_files(log_name, catalog)
+
+    def get_processed_transaction(self, db_name):
+        state_path = os.path.join(self.data_dir, db_name, FileRetention.DB_STATE_FILE_NAME)
+        if not os.path.exists(state_path):
+            return None
+        try:
+            with open(state_path, 'rb') as f:
+                return pickle.load(f).get('last_processed_transaction')
+        except Exception as e:
+            logger.warning(f'failed to read {state_path}: {e}')
+            return None
+
+    def is_processed(self, db_name, last_transaction, processed_transactions: dict) -> bool:
+        if last_transaction is None:
+            return True
+        if db_name not in processed_transactions:
+            processed_transactions[db_name] = self.get_processed_transaction(db_name)
+        processed_transaction = processed_transactions[db_name]
+        if processed_transaction is None:
+            # position zero, nothing is processed
+            return False
+        return last_transaction < processed_transaction
+
+    def remove_processed_files(self, db_name, catalog: FileCatalog):
+        processed_transactions = {}  # db_name => transaction
+        removed_count = 0
+        for entry in catalog.entries:
+            if 'last_transaction' not in entry:
+                break
+            if 'dbs' in entry:
+                processed = all(
+                    self.is_processed(entry_db_name, transactions[1], processed_transactions)
+                    for entry_db_name, transactions in entry['dbs'].items()
+                )
+            else:
+                processed = self.is_processed(db_name, entry['last_transaction'], processed_transactions)
+            if not processed:
+                break
+            removed_count += 1
+        if not removed_count:
+            return
+
+        removed_entries = catalog.entries[:removed_count]
+        catalog.entries = catalog.entries[removed_count:]
+        catalog.save()
+        for entry in removed_entries:
+            file_name = get_file_name_by_num(self.data_dir, db_name, entry['num'])
+            if self.archive_dir:
+                db_archive_dir = os.path.join(self.archive_dir, db_name)
+                os.makedirs(db_archive_dir, exist_ok=True)
+                shutil.move(file_name, os.path.join(db_archive_dir, os.path.basename(file_name)))
+            else:
+                os.remove(file_name)
+        logger.info(
+            f'removed {removed_count} processed files of {db_name}, '
+            f'up to {removed_entries[-1]["num"]}.bin',
+        )
+
+    def compact_files(self, db_name, catalog: FileCatalog):
+        compacted_count = 0
+        for entry in catalog.entries:
+            if compacted_count >= FileRetention.COMPACT_FILES_PER_RUN:
+                break
+            if 'last_transaction' not in entry or entry.get('compacted'):
+                continue
+            file_name = get_file_name_by_num(self.data_dir, db_name, entry['num'])
+            with open(file_name, 'rb') as f:
+                if f.read(len(EVENT_LOG_MAGIC)) != EVENT_LOG_MAGIC:
+                    # pickle format, read as is until it's removed
+                    continue
+            cpp_compact_event_log(
+                file_name, file_name + '.compact', self.compaction_codec, self.compaction_block_size,
+            )
+            os.rename(file_name + '.compact', file_name)
+            entry['compacted'] = True
+            entry['size'] = os.path.getsize(file_name)
+            compacted_count += 1
+        if compacted_count:
+            catalog.save()
+            logger.info(f'compacted {compacted_count} files of {db_name}')
+
+
 class State:
 
     def __init__(self, file_name):
@@ -279,13 +802,21 @@ class State:
         })
         with open(file_name + '.tmp', 'wt') as f:
             f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
         os.rename(file_name + '.tmp', file_name)
+        sync_dir(os.path.dirname(os.path.abspath(file_name)))
 
 
 class BinlogReplicator:
     SAVE_UPDATE_INTERVAL = 60
 
-    def __init__(self, mysql_settings: MysqlSettings, replicator_settings: BinlogReplicatorSettings):
+    def __init__(
+            self,
+            mysql_settings: MysqlSettings,
+            replicator_settings: BinlogReplicatorSettings,
+            databases: list[str] | None = None,
+    ):
         self.mysql_settings = mysql_settings
         self.replicator_settings = replicator_settings
         mysql_settings = {
@@ -295,6 +826,7 @@ class BinlogReplicator:
             'passwd': mysql_settings.password,
         }
         self.data_writer = DataWriter(self.replicator_settings)
+        self.retention = FileRetention(self.replicator_settings, self.data_writer)
         self.state = State(os.path.join(replicator_settings.data_dir, 'state.json'))
         print(" === start pos", self.state.prev_last_seen_transaction)
 
@@ -309,10 +841,85 @@ class BinlogReplicator:
             resume_stream=True,
             log_pos=log_pos,
             log_file=log_file,
+            # everything else is dropped natively before decoding
+            only_events=[DeleteRowsEvent, UpdateRowsEvent, WriteRowsEvent],
+            only_schemas=databases or None,
+            native_event_filter=True,
         )
+
+        # Local copies of the server binlogs (e.g. from a backup) are read
+        # first, the live stream continues from where they end. Once the
+        # stream is past the copied files the saved position is only found
+        # on the server.
+        self.file_stream = None
+        if replicator_settings.binlog_files_dir and (
+            log_file is None
+            or log_file in get_binlog_files(replicator_settings.binlog_files_dir)
+        ):
+            self.file_stream = BinLogFileStreamReader(
+                log_dir=replicator_settings.binlog_files_dir,
+                log_file=log_file,
+                log_pos=log_pos,
+                only_events=[DeleteRowsEvent, UpdateRowsEvent, WriteRowsEvent],
+                only_schemas=databases or None,
+            )
         self.last_state_update = 0
 
+    def catch_up_from_files(self):
+        file_stream = self.file_stream
+        self.file_stream = None
+        read_count = 0
+        last_transaction_id = None
+        for event in file_stream:
+            read_count += 1
+            transaction_id = (file_stream.log_file, file_stream.log_pos)
+            last_transaction_id = transaction_id
+            self.update_state_if_required(transaction_id)
+            self.handle_event(event, transaction_id)
+
+        self.data_writer.flush()
+        if file_stream.log_file is not None:
+            self.stream.log_file = file_stream.log_file
+            self.stream.log_pos = file_stream.log_pos
+            # past the events filtered out after the last stored one
+            last_transaction_id = (file_stream.log_file, file_stream.log_pos)
+        if last_transaction_id is not None:
+            self.update_state_if_required(last_transaction_id, force=True)
+        print('read from binlog files', read_count, 'continue from', file_stream.log_file, file_stream.log_pos)
+
+    def handle_event(self, event, transaction_id):
+        if type(event) not in (DeleteRowsEvent, UpdateRowsEvent, WriteRowsEvent):
+            return
+
+        log_event = LogEvent()
+        log_event.table_name = event.table
+        log_event.db_name = event.schema
+        log_event.transaction_id = transaction_id
+        log_event.is_removal = isinstance(event, DeleteRowsEvent)
+        log_event.records = []
+
+        for row in event.rows:
+            if isinstance(event, DeleteRowsEvent):
+                vals = row["values"]
+                vals = list(vals.values())
+                log_event.records.append(vals)
+
+            elif isinstance(event, UpdateRowsEvent):
+                vals = row["after_values"]
+                vals = list(vals.values())
+                log_event.records.append(vals)
+
+            elif isinstance(event, WriteRowsEvent):
+                vals = row["values"]
+                vals = list(vals.values())
+                log_event.records.append(vals)
+
+        self.data_writer.store_event(log_event)
+
     def run(self):
+        if self.file_stream is not None:
+            self.catch_up_from_files()
+
         last_transaction_id = None
         while True:
             try:
@@ -324,37 +931,18 @@ class BinlogReplicator:
 
                     self.update_state_if_required(transaction_id)
 
-                    if type(event) not in (DeleteRowsEvent, UpdateRowsEvent, WriteRowsEvent):
-                        continue
-
                     assert event.packet.log_pos == self.stream.log_pos
 
-                    log_event = LogEvent()
-                    log_event.table_name = event.table
-                    log_event.db_name = event.schema
-                    log_event.transaction_id = transaction_id
-                    log_event.is_removal = isinstance(event, DeleteRowsEvent)
-                    log_event.records = []
-
-                    for row in event.rows:
-                        if isinstance(event, DeleteRowsEvent):
-                            vals = row["values"]
-                            vals = list(vals.values())
-                            log_event.records.append(vals)
-
-                        elif isinstance(event, UpdateRowsEvent):
-                            vals = row["after_values"]
-                            vals = list(vals.values())
-                            log_event.records.append(vals)
-
-                        elif isinstance(event, WriteRowsEvent):
-                            vals = row["values"]
-                            vals = list(vals.values())
-                            log_event.records.append(vals)
-
-                    self.data_writer.store_event(log_event)
+                    self.handle_event(event, transaction_id)
 
+                self.data_writer.flush()
+                # Events of other dbs and other types are filtered out
+                # without being seen here, the position still moves past
+                # them: the stream stopped at the end of the binlog.
+                if self.stream.log_file is not None:
+                    last_transaction_id = (self.stream.log_file, self.stream.log_pos)
                 self.update_state_if_required(last_transaction_id)
+                self.retention.run_if_required()
                 print("last read count", last_read_count)
                 if last_read_count < 50:
                     time.sleep(10)
@@ -363,12 +951,15 @@ class BinlogReplicator:
                 print('=== operational error', e)
                 time.sleep(15)
 
-    def update_state_if_required(self, transaction_id):
+    def update_state_if_required(self, transaction_id, force=False):
         curr_time = time.time()
-        if curr_time - self.last_state_update < BinlogReplicator.SAVE_UPDATE_INTERVAL:
+        if curr_time - self.last_state_update < BinlogReplicator.SAVE_UPDATE_INTERVAL and not force:
             return
         if not os.path.exists(self.replicator_settings.data_dir):
             os.mkdir(self.replicator_settings.data_dir)
+        # a restart continues from the saved position,
+        # everything before it has to be on disk
+        self.data_writer.sync()
         self.state.prev_last_seen_transaction = self.state.last_seen_transaction
         self.state.last_seen_transaction = transaction_id
         self.state.save()
@@ -1,38 +1,108 @@
+import decimal
+import threading
+from array import array
+from logging import getLogger
+
 import clickhouse_connect
 
 from config import ClickhouseSettings
 from table_structure import TableStructure, TableField
+from pymysqlreplication.cpp_accelerated import cpp_clickhouse_type_supported, cpp_encode_clickhouse_native
+
+
+logger = getLogger(__name__)
 
 
 CREATE_TABLE_QUERY = '''
 CREATE TABLE {db_name}.{table_name}
 (
 {fields},
-    `_version` UInt64,
+    `_version` UInt64,{is_deleted_column}
     INDEX _version _version TYPE minmax GRANULARITY 1,
     INDEX idx_id {primary_key} TYPE bloom_filter GRANULARITY 1
 )
-ENGINE = ReplacingMergeTree(_version)
+ENGINE = ReplacingMergeTree({engine_columns})
 {partition_by}ORDER BY {primary_key}
-SETTINGS index_granularity = 8192
+SETTINGS index_granularity = 8192, non_replicated_deduplication_window = {deduplication_window}
 '''
 
 DELETE_QUERY = '''
 DELETE FROM {db_name}.{table_name} WHERE {field_name} IN ({field_values})
 '''
 
+# With tombstone deletes a deleted record is a row with _is_deleted = 1 and
+# the version of the delete, ReplacingMergeTree drops the record on merges
+# and FINAL hides it. The other columns of a tombstone get their defaults.
+IS_DELETED_COLUMN = '_is_deleted'
+
+# inserts remembered per table for insert_deduplication_token, replays
+# after a restart only repeat the last few. Without the setting (tables
+# created before it was added) tokens are ignored, it is set on the
+# existing tables when realtime replication starts.
+DEDUPLICATION_WINDOW = 1000
+
+SET_DEDUPLICATION_WINDOW_QUERY = '''
+ALTER TABLE {db_name}.{table_name} MODIFY SETTING non_replicated_deduplication_window = {deduplication_window}
+'''
+
+
+def connect(clickhouse_settings: ClickhouseSettings):
+    return clickhouse_connect.get_client(
+        host=clickhouse_settings.host,
+        port=clickhouse_settings.port,
+        username=clickhouse_settings.user,
+        password=clickhouse_settings.password,
+    )
+
+
+class ClickhouseClientPool:
+    """A connection per thread, shared by the ClickhouseApi of all the
+    databases replicated in a process (queries name the database, clients
+    aren't bound to one). A client can't run queries concurrently."""
+
+    def __init__(self, clickhouse_settings: ClickhouseSettings):
+        self.clickhouse_settings = clickhouse_settings
+        self.thread_state = threading.local()
+
+    def get_client(self):
+        client = getattr(self.thread_state, 'client', None)
+        if client is None:
+            client = connect(self.clickhouse_settings)
+            self.thread_state.client = client
+        return client
+
+
+def format_sql_value(value) -> str:
+    """A primary key value as a ClickHouse literal"""
+    if isinstance(value, bool):
+        return str(int(value))
+    if isinstance(value, (int, float, decimal.Decimal)):
+        return str(value)
+    if isinstance(value, (bytes, bytearray)):
+        # VARBINARY keys, any bytes
+        return f"unhex('{value.hex()}')"
+    # strings, dates and everything else by their text
+    value = str(value).replace('\\', '\\\\').replace("'", "\\'")
+    return f"'{value}'"
+
 
 class ClickhouseApi:
-    def __init__(self, database: str, clickhouse_settings: ClickhouseSettings):
+    def __init__(self, database: str, clickhouse_settings: ClickhouseSettings,
+                 client_pool: ClickhouseClientPool | None = None):
+        """With a client pool the api can be used from any thread, the
+        queries go through the connection of the calling thread"""
         self.database = database
         self.clickhouse_settings = clickhouse_settings
-        self.client = clickhouse_connect.get_client(
-            host=clickhouse_settings.host,
-            port=clickhouse_settings.port,
-            username=clickhouse_settings.user,
-            password=clickhouse_settings.password,
-        )
-        self.tables_last_record_version = {}  # table_name => last used row version
+        self.client_pool = client_pool
+        self.own_client = None
+        if client_pool is None:
+            self.own_client = connect(clickhouse_settings)
+
+    @property
+    def client(self):
+        if self.client_pool is not None:
+            return self.client_pool.get_client()
+        return self.own_client
 
     def get_tables(self):
         return []
@@ -47,12 +117,6 @@ class ClickhouseApi:
         self.execute_command(f'DROP DATABASE IF EXISTS {self.database}')
         self.execute_command(f'CREATE DATABASE {self.database}')
 
-    def get_last_used_version(self, table_name):
-        return self.tables_last_record_version.get(table_name, 0)
-
-    def set_last_used_version(self, table_name, last_used_version):
-        self.tables_last_record_version[table_name] = last_used_version
-
     def create_table(self, table_name, structure: TableStructure):
         if not structure.primary_key:
             raise Exception(f'missing primary key for {table_name}')
@@ -73,33 +137,100 @@ class ClickhouseApi:
         if 'int' in primary_key_type.lower():
             partition_by = f'PARTITION BY intDiv({structure.primary_key}, 4294967)\n'
 
+        is_deleted_column = ''
+        engine_columns = '_version'
+        if self.clickhouse_settings.tombstone_deletes:
+            is_deleted_column = f'\n    `{IS_DELETED_COLUMN}` UInt8,'
+            engine_columns = f'_version, {IS_DELETED_COLUMN}'
+
         query = CREATE_TABLE_QUERY.format(**{
             'db_name': self.database,
             'table_name': table_name,
             'fields': fields,
             'primary_key': structure.primary_key,
             'partition_by': partition_by,
+            'is_deleted_column': is_deleted_column,
+            'engine_columns': engine_columns,
+            'deduplication_window': DEDUPLICATION_WINDOW,
         })
         self.execute_command(query)
 
-    def insert(self, table_name, records):
-        current_version = self.get_last_used_version(table_name) + 1
-
-        records_to_insert = []
-        for record in records:
-            records_to_insert.append(tuple(record) + (current_version,))
-            current_version += 1
+    def set_deduplication_window(self, table_name):
+        """Enables deduplication by insert tokens on a table created
+        without it, logs a warning if that fails"""
+        query = SET_DEDUPLICATION_WINDOW_QUERY.format(**{
+            'db_name': self.database,
+            'table_name': table_name,
+            'deduplication_window': DEDUPLICATION_WINDOW,
+        })
+        try:
+            self.execute_command(query)
+        except Exception as e:
+            logger.warning(
+                f'failed to set non_replicated_deduplication_window of {self.database}.{table_name}, '
+                f'uploads replayed after a restart may be inserted twice: {e}'
+            )
+
+    def insert(self, table_name, records, versions: bytes, structure: TableStructure | None = None,
+               deduplication_token=None):
+        """Inserts the records with their _version, `versions` has one per
+        record as native uint64 (see transaction_version).
+
+        With the clickhouse structure of the table the records are encoded
+        natively into a Native format block, otherwise (or if the table has
+        types the encoder doesn't know) clickhouse_connect serializes them
+        value by value.
+
+        ClickHouse skips an insert with the deduplication token of one of
+        the last DEDUPLICATION_WINDOW inserts into the table."""
+        settings = {}
+        if deduplication_token is not None:
+            settings['insert_deduplication_token'] = deduplication_token
 
         full_table_name = table_name
         if '.' not in full_table_name:
             full_table_name = f'{self.database}.{table_name}'
 
-        self.client.insert(table=full_table_name, data=records_to_insert)
+        if structure is not None and self.insert_native(full_table_name, records, structure, versions, settings):
+            return
 
-        self.set_last_used_version(table_name, current_version)
+        records_to_insert = [
+            tuple(record) + (version,) for record, version in zip(records, array('Q', versions))
+        ]
 
-    def erase(self, table_name, field_name, field_values):
-        field_values = ', '.join(list(map(str, field_values)))
+        column_names = '*'
+        if structure is not None:
+            column_names = [field.name for field in structure.fields] + ['_version']
+        self.client.insert(table=full_table_name, data=records_to_insert, column_names=column_names, settings=settings)
+
+    def insert_native(self, full_table_name, records, structure: TableStructure, versions, settings) -> bool:
+        column_names = [field.name for field in structure.fields]
+        column_types = [field.field_type for field in structure.fields]
+        if not all(map(cpp_clickhouse_type_supported, column_types)):
+            return False
+        try:
+            data = cpp_encode_clickhouse_native(records, column_names, column_types, versions)
+        except (TypeError, OverflowError) as e:
+            logger.warning(f'failed to encode records of {full_table_name} natively: {e}')
+            return False
+        self.client.raw_insert(
+            full_table_name, column_names=column_names + ['_version'], insert_block=data, settings=settings,
+            fmt='Native',
+        )
+        return True
+
+    def erase(self, table_name, field_name, field_values, versions: bytes | None = None,
+              structure: TableStructure | None = None, deduplication_token=None):
+        """Deletes the records with the given primary key values, by
+        tombstone inserts if enabled (needs the versions of the deletes and
+        the clickhouse structure of the table for the primary key type),
+        otherwise by a DELETE query, which repeated has no effect and needs
+        no deduplication token"""
+        if self.clickhouse_settings.tombstone_deletes:
+            self.insert_tombstones(table_name, field_name, field_values, versions, structure, deduplication_token)
+            return
+
+        field_values = ', '.join(map(format_sql_value, field_values))
         query = DELETE_QUERY.format(**{
             'db_name': self.database,
             'table_name': table_name,
@@ -107,3 +238,18 @@ class ClickhouseApi:
             'field_values': field_values,
         })
         self.execute_command(query)
+
+    def insert_tombstones(self, table_name, field_name, field_values, versions, structure: TableStructure,
+                          deduplication_token):
+        field_type = ''
+        for field in structure.fields:
+            if field.name == field_name:
+                field_type = field.field_type
+        if not field_type:
+            raise Exception(f'failed to get type of primary key {table_name} {field_name}')
+        tombstones_structure = TableStructure(
+            fields=[TableField(field_name, field_type), TableField(IS_DELETED_COLUMN, 'UInt8')],
+        )
+        self.insert(
+            table_name, [(value, 1) for value in field_values], versions, tombstones_structure, deduplication_token,
+        )
@@ -17,12 +17,32 @@ class ClickhouseSettings:
     port: int = 3306
     user: str = 'root'
     password: str = ''
+    upload_workers: int = 4  # tables uploaded concurrently, each worker has its own connection; per process with several --db
+    tombstone_deletes: bool = False  # deletes insert rows with _is_deleted = 1 instead of DELETE queries, set before the first run
 
 
 @dataclass
 class BinlogReplicatorSettings:
     data_dir: str = 'binlog'
     records_per_file: int = 100000
+    binlog_files_dir: str = ''
+    compression: str = 'lz4'  # lz4, zstd, zlib or none
+    compression_block_size: int = 1 << 20
+    flush_interval: float = 1.0  # seconds an event may wait in a block before it is written
+    fsync: bool = True  # fdatasync the event files before saving the replication state
+    retention_interval: int = 3600  # seconds between removals of processed event files, 0 disables
+    retention_archive_dir: str = ''  # move removed event files there instead of deleting them
+    compaction_codec: str = ''  # rewrite completed event files with this codec (e.g. zstd), empty disables
+    compaction_block_size: int = 16 << 20
+    shared_log: bool = False  # one event log for all databases instead of files per database, set before the first run
+
+
+@dataclass
+class DbReplicatorSettings:
+    staging_memory_limit: int = 512 << 20  # bytes of records waiting for upload (estimated), reaching it uploads them early
+    upload_part_rows: int = 100000  # records of a table uploaded as one insert (ClickHouse part)
+    upload_part_size: int = 64 << 20  # bytes of the records of a table uploaded as one insert (estimated)
+    upload_max_delay: float = 10.0  # seconds until a record should be in ClickHouse, upload time included
 
 
 class Settings:
@@ -31,6 +51,7 @@ class Settings:
         self.mysql = MysqlSettings()
         self.clickhouse = ClickhouseSettings()
         self.binlog_replicator = BinlogReplicatorSettings()
+        self.db_replicator = DbReplicatorSettings()
         self.databases = []
 
     def load(self, settings_file):
@@ -42,3 +63,4 @@ class Settings:
         self.databases = data['databases']
         assert isinstance(self.databases, list)
         self.binlog_replicator = BinlogReplicatorSettings(**data['binlog_replicator'])
+        self.db_replicator = DbReplicatorSettings(**data.get('db_replicator', {}))
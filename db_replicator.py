@@ -1,18 +1,24 @@
 import json
 import os.path
+import queue
+import struct
+import sys
+import threading
 import time
 import pickle
+from concurrent.futures import ThreadPoolExecutor, wait
 from logging import getLogger
 from enum import Enum
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 from collections import defaultdict
 
-from config import Settings, MysqlSettings, ClickhouseSettings
+from config import Settings, MysqlSettings, ClickhouseSettings, DbReplicatorSettings
 from mysql_api import MySQLApi
-from clickhouse_api import ClickhouseApi
+from clickhouse_api import ClickhouseApi, ClickhouseClientPool
 from converter import MysqlToClickhouseConverter
 from table_structure import TableStructure
-from binlog_replicator import DataReader, LogEvent
+from binlog_replicator import DataReader, LogEvent, transaction_version
+from pymysqlreplication.cpp_accelerated import NativeStagingTable
 
 
 logger = getLogger(__name__)
@@ -32,7 +38,6 @@ class State:
         self.last_processed_transaction = None
         self.last_processed_transaction_non_uploaded = None
         self.status = Status.NONE
-        self.tables_last_record_version = {}
         self.initial_replication_table = None
         self.initial_replication_max_primary_key = None
         self.tables_structure: dict[str, tuple[TableStructure, TableStructure]] = {}
@@ -48,7 +53,6 @@ class State:
         self.last_processed_transaction = data['last_processed_transaction']
         self.last_processed_transaction_non_uploaded = data['last_processed_transaction']
         self.status = Status(data['status'])
-        self.tables_last_record_version = data['tables_last_record_version']
         self.initial_replication_table = data['initial_replication_table']
         self.initial_replication_max_primary_key = data['initial_replication_max_primary_key']
         self.tables_structure = data['tables_structure']
@@ -59,7 +63,6 @@ class State:
         data = pickle.dumps({
             'last_processed_transaction': self.last_processed_transaction,
             'status': self.status.value,
-            'tables_last_record_version': self.tables_last_record_version,
             'initial_replication_table': self.initial_replication_table,
             'initial_replication_max_primary_key': self.initial_replication_max_primary_key,
             'tables_structure': self.tables_structure,
@@ -78,6 +81,312 @@ class Statistics:
     insert_records_count: int = 0
     erase_events_count: int = 0
     erase_records_count: int = 0
+    staged_memory_size: int = 0  # at the time of the dump
+    staged_memory_peak: int = 0
+    memory_limit_uploads_count: int = 0
+    upload_batches_count: int = 0
+    uploaded_tables_count: int = 0
+
+
+# python object overhead of a staged record besides its values: the dict
+# entry, or the set entry of a deleted key
+STAGED_ENTRY_OVERHEAD = 100
+
+
+def estimate_record_size(record) -> int:
+    return sys.getsizeof(record) + sum(map(sys.getsizeof, record)) + STAGED_ENTRY_OVERHEAD
+
+
+class StagingMemory:
+    """Estimated memory of the records staged for upload, shared by the db
+    replicators of a process: staging_memory_limit bounds the process."""
+
+    def __init__(self):
+        self.size = 0
+
+
+@dataclass
+class UploadBatch:
+    # versions as bytes of native uint64, one per record or key
+    records_to_insert: dict  # table_name => ([record, ...], versions)
+    records_to_delete: dict  # table_name => ([record_id, ...], versions)
+    transaction_id: tuple[str, int] | None  # all events up to it are uploaded after the batch
+    table_sizes: dict = field(default_factory=dict)  # table_name => estimated bytes
+    # table_name => (last transaction before its records, last transaction of its records)
+    table_ranges: dict = field(default_factory=dict)
+
+
+def transaction_range_token(database, table_name, transaction_range, kind) -> str:
+    """insert_deduplication_token of the records of a table staged from a
+    range of transactions: replaying the same events stages the same
+    records, the repeated insert is then skipped by ClickHouse.
+
+    After a restart all tables are staged from the saved position, ranges
+    of tables that had records before it uploaded differ from the first
+    run. Those records are inserted again with the same _version and only
+    collapse when ReplacingMergeTree merges the parts (or with FINAL)."""
+    first, last = (
+        'start' if transaction_id is None else f'{transaction_id[0]}:{transaction_id[1]}'
+        for transaction_id in transaction_range
+    )
+    return f'{database}.{table_name}:{first}..{last}:{kind}'
+
+
+@dataclass
+class TableUploadStats:
+    staged_rows: int = 0
+    staged_size: int = 0  # estimated bytes
+    staged_time: float = 0  # when the oldest staged record came, 0 if there is none
+    staged_after: tuple[str, int] | None = None  # last transaction before the oldest staged record
+    staged_until: tuple[str, int] | None = None  # transaction of the latest staged record
+    upload_seconds: float = 0  # smoothed insert latency
+    upload_speed: float = 0  # smoothed bytes per second
+
+
+class UploadScheduler:
+    """Decides which tables are uploaded, each table on its own: once its
+    staged records reach the part size, or once the oldest of them would
+    otherwise miss upload_max_delay (the expected upload time of the table
+    included). Cold tables so collect larger parts instead of being
+    uploaded along with hot ones. A table whose uploads are too slow to
+    finish within half the delay gets smaller parts.
+
+    Uploading only some tables, the position can only move up to the last
+    transaction before the oldest record still staged."""
+
+    # weight of the latest upload in the smoothed latency and speed
+    UPLOAD_TIME_SMOOTHING = 0.3
+    MIN_PART_SIZE = 1 << 20
+    AGE_CHECK_INTERVAL = 1
+
+    def __init__(self, settings: DbReplicatorSettings):
+        self.settings = settings
+        self.tables: dict[str, TableUploadStats] = defaultdict(TableUploadStats)
+        self.last_age_check_time = 0
+
+    def staged(self, table_name, rows, size, staged_after, transaction_id, now):
+        table = self.tables[table_name]
+        if table.staged_time == 0:
+            table.staged_time = now
+            table.staged_after = staged_after
+        table.staged_until = transaction_id
+        table.staged_rows += rows
+        table.staged_size += size
+
+    def part_size(self, table: TableUploadStats):
+        part_size = self.settings.upload_part_size
+        if table.upload_speed > 0:
+            part_size = min(part_size, int(table.upload_speed * self.settings.upload_max_delay / 2))
+        return max(part_size, min(UploadScheduler.MIN_PART_SIZE, self.settings.upload_part_size))
+
+    def is_full(self, table: TableUploadStats):
+        if table.staged_time == 0:
+            return False
+        return table.staged_rows >= self.settings.upload_part_rows or table.staged_size >= self.part_size(table)
+
+    def due_tables(self, table_name, now, staged_memory_size) -> tuple[list[str], bool]:
+        """Tables to upload and whether the memory limit was reached, the
+        age of all tables is checked at most every AGE_CHECK_INTERVAL"""
+        due = set()
+        if table_name is not None and self.is_full(self.tables[table_name]):
+            due.add(table_name)
+
+        if now - self.last_age_check_time >= UploadScheduler.AGE_CHECK_INTERVAL:
+            self.last_age_check_time = now
+            for name, table in self.tables.items():
+                if table.staged_time == 0:
+                    continue
+                # at least half of the delay is left for collecting records
+                max_age = max(self.settings.upload_max_delay - table.upload_seconds, self.settings.upload_max_delay / 2)
+                if now - table.staged_time >= max_age:
+                    due.add(name)
+
+        memory_limit_reached = staged_memory_size >= self.settings.staging_memory_limit
+        if memory_limit_reached:
+            # the largest tables, until half of the limit is left
+            remaining_size = staged_memory_size - sum(self.tables[name].staged_size for name in due)
+            largest = sorted(self.tables.items(), key=lambda item: item[1].staged_size, reverse=True)
+            for name, table in largest:
+                if remaining_size <= self.settings.staging_memory_limit // 2 or table.staged_time == 0:
+                    break
+                if name not in due:
+                    due.add(name)
+                    remaining_size -= table.staged_size
+        return sorted(due), memory_limit_reached
+
+    def take(self, table_name) -> tuple[int, tuple]:
+        """Marks the staged records of the table as uploaded, returns their
+        estimated size and the range of transactions they come from"""
+        table = self.tables[table_name]
+        staged_size = table.staged_size
+        transaction_range = (table.staged_after, table.staged_until)
+        table.staged_rows = 0
+        table.staged_size = 0
+        table.staged_time = 0
+        table.staged_after = None
+        table.staged_until = None
+        return staged_size, transaction_range
+
+    def uploaded(self, table_name, size, seconds):
+        table = self.tables[table_name]
+        if table.upload_seconds == 0:
+            table.upload_seconds = seconds
+            table.upload_speed = size / max(seconds, 1e-3)
+            return
+        weight = UploadScheduler.UPLOAD_TIME_SMOOTHING
+        table.upload_seconds += weight * (seconds - table.upload_seconds)
+        table.upload_speed += weight * (size / max(seconds, 1e-3) - table.upload_speed)
+
+    def has_staged(self):
+        return any(table.staged_time != 0 for table in self.tables.values())
+
+    def checkpoint(self, last_transaction):
+        """Position up to which everything is uploaded once the batches
+        taken so far are"""
+        staged_after = [table.staged_after for table in self.tables.values() if table.staged_time != 0]
+        if not staged_after:
+            return last_transaction
+        # None (before the first event) comes first
+        return min(staged_after, key=lambda transaction_id: (transaction_id is not None, transaction_id))
+
+
+class UploadPipeline:
+    """Sends batches to ClickHouse from a background thread, in the order
+    they were queued, so that events are read and converted while the
+    previous batch is being uploaded. The queue is bounded, queueing blocks
+    while queue_size batches are waiting.
+
+    A batch is acknowledged once its inserts and deletes are done, the db
+    replicator only saves the position of the last acknowledged batch:
+    after a restart everything past it is read from the event files again.
+    An upload error stops the pipeline and is raised in the db replicator
+    thread on the next call.
+
+    With several workers the tables of a batch are uploaded concurrently,
+    every worker thread with a ClickhouseApi (connection) of its own. The
+    inserts and deletes of a table stay in order, the batch is acknowledged
+    once all its tables are done, batches are still uploaded one by one.
+
+    The workers can be shared by the pipelines of several databases (with a
+    ClickhouseApi of a client pool), all tables are then uploaded by them,
+    so that the connections are only the ones of the workers."""
+
+    def __init__(self, clickhouse_api: ClickhouseApi, tables_structure: dict, queue_size: int, workers: int,
+                 executor: ThreadPoolExecutor | None = None):
+        self.clickhouse_api = clickhouse_api
+        self.tables_structure = tables_structure
+        self.executor = executor
+        self.shared_executor = executor is not None
+        if executor is None and workers > 1:
+            self.executor = ThreadPoolExecutor(max_workers=workers, thread_name_prefix='clickhouse-upload-table')
+        self.worker_state = threading.local()
+        self.batches = queue.Queue(maxsize=queue_size)
+        self.lock = threading.Lock()
+        # (transaction_id,) of the last uploaded batch, the transaction can be None
+        self.acknowledged = None
+        self.upload_times = []  # (table_name, size, seconds) since the last pop
+        self.error = None
+        self.thread = threading.Thread(
+            target=self.run, name=f'clickhouse-upload-{clickhouse_api.database}', daemon=True,
+        )
+        self.thread.start()
+
+    def put(self, batch: UploadBatch):
+        while True:
+            self.check_error()
+            try:
+                self.batches.put(batch, timeout=1)
+                return
+            except queue.Full:
+                continue
+
+    def is_full(self):
+        return self.batches.full()
+
+    def pop_acknowledged(self):
+        self.check_error()
+        with self.lock:
+            acknowledged, self.acknowledged = self.acknowledged, None
+        return acknowledged
+
+    def pop_upload_times(self):
+        with self.lock:
+            upload_times, self.upload_times = self.upload_times, []
+        return upload_times
+
+    def check_error(self):
+        if self.error is not None:
+            raise Exception('clickhouse upload failed') from self.error
+
+    def run(self):
+        while True:
+            batch = self.batches.get()
+            try:
+                self.upload(batch)
+            except Exception as e:
+                logger.error(f'clickhouse upload failed: {e}')
+                self.error = e
+                return
+            with self.lock:
+                self.acknowledged = (batch.transaction_id,)
+
+    def upload(self, batch: UploadBatch):
+        table_names = sorted(set(batch.records_to_insert) | set(batch.records_to_delete))
+        if self.executor is None or (len(table_names) <= 1 and not self.shared_executor):
+            for table_name in table_names:
+                self.upload_table(self.clickhouse_api, batch, table_name)
+            return
+        futures = [
+            self.executor.submit(self.upload_table_in_worker, batch, table_name) for table_name in table_names
+        ]
+        # the batch fails as a whole, but only once no table is being uploaded
+        wait(futures)
+        for future in futures:
+            future.result()
+
+    def upload_table_in_worker(self, batch: UploadBatch, table_name):
+        if self.clickhouse_api.client_pool is not None:
+            self.upload_table(self.clickhouse_api, batch, table_name)
+            return
+        clickhouse_api = getattr(self.worker_state, 'clickhouse_api', None)
+        if clickhouse_api is None:
+            clickhouse_api = ClickhouseApi(self.clickhouse_api.database, self.clickhouse_api.clickhouse_settings)
+            self.worker_state.clickhouse_api = clickhouse_api
+        self.upload_table(clickhouse_api, batch, table_name)
+
+    def upload_table(self, clickhouse_api: ClickhouseApi, batch: UploadBatch, table_name):
+        start_time = time.monotonic()
+        self.upload_table_records(clickhouse_api, batch, table_name)
+        seconds = time.monotonic() - start_time
+        with self.lock:
+            self.upload_times.append((table_name, batch.table_sizes.get(table_name, 0), seconds))
+
+    def upload_table_records(self, clickhouse_api: ClickhouseApi, batch: UploadBatch, table_name):
+        transaction_range = batch.table_ranges.get(table_name)
+        insert_token = None
+        delete_token = None
+        if transaction_range is not None:
+            database = clickhouse_api.database
+            insert_token = transaction_range_token(database, table_name, transaction_range, 'insert')
+            delete_token = transaction_range_token(database, table_name, transaction_range, 'delete')
+
+        if table_name in batch.records_to_insert:
+            records, versions = batch.records_to_insert[table_name]
+            clickhouse_structure = self.tables_structure[table_name][1]
+            clickhouse_api.insert(table_name, records, versions, clickhouse_structure, insert_token)
+
+        if table_name in batch.records_to_delete:
+            keys_to_remove, versions = batch.records_to_delete[table_name]
+            table_structure: TableStructure = self.tables_structure[table_name][0]
+            primary_key_name = table_structure.primary_key
+            clickhouse_api.erase(
+                table_name=table_name,
+                field_name=primary_key_name,
+                field_values=keys_to_remove,
+                versions=versions,
+                structure=self.tables_structure[table_name][1],
+                deduplication_token=delete_token,
+            )
 
 
 class DbReplicator:
@@ -86,41 +395,66 @@ class DbReplicator:
     SAVE_STATE_INTERVAL = 10
     STATS_DUMP_INTERVAL = 60
 
-    DATA_DUMP_INTERVAL = 10
-    DATA_DUMP_BATCH_SIZE = 10000
+    READ_WAIT_TIMEOUT = 1
+    UPLOAD_QUEUE_SIZE = 2
+    EVENTS_PER_READ = 1000
 
-    def __init__(self, config: Settings, database: str):
+    def __init__(self, config: Settings, database: str, client_pool: ClickhouseClientPool | None = None,
+                 upload_executor: ThreadPoolExecutor | None = None, staging_memory: StagingMemory | None = None):
+        """client_pool, upload_executor and staging_memory are shared by the
+        replicators of several databases in one process, see MultiDbReplicator"""
         self.config = config
         self.database = database
-        self.mysql_api = MySQLApi(
-            database=database,
-            mysql_settings=config.mysql,
-        )
+        # connected until the initial replication is done
+        self.mysql_api: MySQLApi | None = None
         self.clickhouse_api = ClickhouseApi(
             database=database,
             clickhouse_settings=config.clickhouse,
+            client_pool=client_pool,
         )
+        self.upload_executor = upload_executor
         self.converter = MysqlToClickhouseConverter()
         self.data_reader = DataReader(config.binlog_replicator, database)
         self.state = State(os.path.join(config.binlog_replicator.data_dir, database, 'state.pckl'))
-        self.clickhouse_api.tables_last_record_version = self.state.tables_last_record_version
         self.last_save_state_time = 0
         self.stats = Statistics()
         self.last_dump_stats_time = 0
-        self.records_to_insert = defaultdict(dict)  # table_name => {record_id=>record, ...}
-        self.records_to_delete = defaultdict(set)  # table_name => {record_id, ...}
+        # table_name => records and deleted keys waiting for upload, by primary key
+        self.staged_tables: dict[str, NativeStagingTable] = defaultdict(NativeStagingTable)
+        # estimated memory of the records above, bounded by staging_memory_limit
+        # along with the ones of the other dbs sharing staging_memory; batches
+        # waiting for upload are bounded by the upload queue
+        self.staged_memory_size = 0
+        self.staging_memory = staging_memory if staging_memory is not None else StagingMemory()
+        self.upload_scheduler = UploadScheduler(config.db_replicator)
         self.last_records_upload_time = 0
+        self.last_uploaded_transaction = None  # of the last queued batch
+        self.upload_pipeline: UploadPipeline | None = None
 
     def run(self):
+        self.replicate_initial_data()
+        self.run_realtime_replication()
+
+    def replicate_initial_data(self):
+        """Creates the tables and copies their records, unless (or as far as)
+        this was done before"""
         if self.state.status == Status.RUNNING_REALTIME_REPLICATION:
-            self.run_realtime_replication()
             return
-        if self.state.status == Status.PERFORMING_INITIAL_REPLICATION:
-            self.perform_initial_replication()
-            self.run_realtime_replication()
-            return
-
-        logger.info('recreating database')
+        self.mysql_api = MySQLApi(
+            database=self.database,
+            mysql_settings=self.config.mysql,
+        )
+        try:
+            if self.state.status == Status.PERFORMING_INITIAL_REPLICATION:
+                self.perform_initial_replication()
+            else:
+                self.create_database()
+        finally:
+            self.mysql_api.close()
+            self.mysql_api = None
+
+    def create_database(self):
+        logger.info(f'recreating database {self.database}')
         self.clickhouse_api.recreate_database()
         self.state.tables = self.mysql_api.get_tables()
         self.state.last_processed_transaction = self.data_reader.get_last_transaction_id()
@@ -128,7 +462,6 @@ class DbReplicator:
         logger.info(f'last known transaction {self.state.last_processed_transaction}')
         self.create_initial_structure()
         self.perform_initial_replication()
-        self.run_realtime_replication()
 
     def create_initial_structure(self):
         self.state.status = Status.CREATING_INITIAL_STRUCTURES
@@ -176,6 +509,10 @@ class DbReplicator:
         primary_key_index = field_names.index(primary_key)
         primary_key_type = field_types[primary_key_index]
 
+        # the records are at least as new as the position realtime
+        # replication starts from, its events get higher versions
+        version = struct.pack('<Q', transaction_version(self.state.last_processed_transaction))
+
         while True:
 
             query_start_value = max_primary_key
@@ -196,7 +533,7 @@ class DbReplicator:
 
             if not records:
                 break
-            self.clickhouse_api.insert(table_name, records)
+            self.clickhouse_api.insert(table_name, records, version * len(records), clickhouse_table_structure)
             for record in records:
                 record_primary_key = record[primary_key_index]
                 if max_primary_key is None:
@@ -208,17 +545,41 @@ class DbReplicator:
             self.save_state_if_required()
 
     def run_realtime_replication(self):
-        logger.info(f'running realtime replication from the position: {self.state.last_processed_transaction}')
+        self.start_realtime_replication()
+        while True:
+            if self.process_events(DbReplicator.EVENTS_PER_READ) == 0:
+                self.data_reader.wait_for_events(DbReplicator.READ_WAIT_TIMEOUT)
+
+    def start_realtime_replication(self):
+        logger.info(
+            f'running realtime replication of {self.database} from the position: '
+            f'{self.state.last_processed_transaction}'
+        )
         self.state.status = Status.RUNNING_REALTIME_REPLICATION
         self.state.save()
+        # tables created before insert deduplication
+        for table_name in self.state.tables_structure:
+            self.clickhouse_api.set_deduplication_window(table_name)
         self.data_reader.set_position(self.state.last_processed_transaction)
-        while True:
+        self.upload_pipeline = UploadPipeline(
+            self.clickhouse_api,
+            self.state.tables_structure,
+            DbReplicator.UPLOAD_QUEUE_SIZE,
+            self.config.clickhouse.upload_workers,
+            self.upload_executor,
+        )
+
+    def process_events(self, max_events) -> int:
+        """Handles up to max_events events that are already written, returns
+        how many. Once there are none left, the staged records are checked
+        for upload."""
+        for events_count in range(max_events):
             event = self.data_reader.read_next_event()
             if event is None:
-                time.sleep(10)
                 self.upload_records_if_required(table_name=None)
-                continue
+                return events_count
             self.handle_event(event)
+        return max_events
 
     def handle_event(self, event: LogEvent):
         if self.state.last_processed_transaction_non_uploaded is not None:
@@ -228,12 +589,21 @@ class DbReplicator:
         logger.debug(f'processing event {event.transaction_id}')
         self.stats.events_count += 1
         self.stats.last_transaction = event.transaction_id
+        previous_transaction = self.state.last_processed_transaction_non_uploaded
         self.state.last_processed_transaction_non_uploaded = event.transaction_id
 
         if not event.is_removal:
-            self.handle_insert_event(event)
+            staged_count, staged_size = self.handle_insert_event(event)
         else:
-            self.handle_erase_event(event)
+            staged_count, staged_size = self.handle_erase_event(event)
+        if event.records:
+            # updates of staged records extend the transaction range too
+            self.upload_scheduler.staged(
+                event.table_name, staged_count, staged_size, previous_transaction, event.transaction_id, time.time(),
+            )
+            self.staged_memory_size += staged_size
+            self.staging_memory.size += staged_size
+            self.stats.staged_memory_peak = max(self.stats.staged_memory_peak, self.staged_memory_size)
 
         self.upload_records_if_required(table_name=event.table_name)
 
@@ -245,7 +615,6 @@ class DbReplicator:
         if curr_time - self.last_save_state_time < DbReplicator.SAVE_STATE_INTERVAL:
             return
         self.last_save_state_time = curr_time
-        self.state.tables_last_record_version = self.clickhouse_api.tables_last_record_version
         self.state.save()
 
     def handle_insert_event(self, event: LogEvent):
@@ -258,77 +627,163 @@ class DbReplicator:
 
         primary_key_ids = mysql_table_structure.primary_key_idx
 
-        current_table_records_to_insert = self.records_to_insert[event.table_name]
-        current_table_records_to_delete = self.records_to_delete[event.table_name]
-        for record in records:
-            record_id = record[primary_key_ids]
-            current_table_records_to_insert[record_id] = record
-            current_table_records_to_delete.discard(record_id)
+        first_version = transaction_version(event.transaction_id, len(event.records))
+        staged_count = self.staged_tables[event.table_name].apply(records, primary_key_ids, False, first_version)
+        # records of an event have about the same size, updates of staged
+        # records don't add any
+        if staged_count == 0:
+            return 0, 0
+        return staged_count, staged_count * estimate_record_size(records[0])
 
     def handle_erase_event(self, event: LogEvent):
         self.stats.erase_events_count += 1
         self.stats.erase_records_count += len(event.records)
 
         table_structure: TableStructure = self.state.tables_structure[event.table_name][0]
-        table_structure_ch: TableStructure = self.state.tables_structure[event.table_name][1]
 
         primary_key_name_idx = table_structure.primary_key_idx
-        field_type_ch = table_structure_ch.fields[primary_key_name_idx].field_type
 
-        if field_type_ch == 'String':
-            keys_to_remove = [f"'{record[primary_key_name_idx]}'" for record in event.records]
-        else:
-            keys_to_remove = [record[primary_key_name_idx] for record in event.records]
-
-        current_table_records_to_insert = self.records_to_insert[event.table_name]
-        current_table_records_to_delete = self.records_to_delete[event.table_name]
-        for record_id in keys_to_remove:
-            current_table_records_to_delete.add(record_id)
-            current_table_records_to_insert.pop(record_id, None)
+        first_version = transaction_version(event.transaction_id, len(event.records))
+        staged_count = self.staged_tables[event.table_name].apply(
+            event.records, primary_key_name_idx, True, first_version,
+        )
+        if staged_count == 0:
+            return 0, 0
+        key_size = sys.getsizeof(event.records[0][primary_key_name_idx]) + STAGED_ENTRY_OVERHEAD
+        return staged_count, staged_count * key_size
 
     def log_stats_if_required(self):
         curr_time = time.time()
         if curr_time - self.last_dump_stats_time < DbReplicator.STATS_DUMP_INTERVAL:
             return
         self.last_dump_stats_time = curr_time
-        logger.info(f'statistics:\n{json.dumps(self.stats.__dict__, indent=3)}')
+        self.stats.staged_memory_size = self.staged_memory_size
+        logger.info(f'statistics of {self.database}:\n{json.dumps(self.stats.__dict__, indent=3)}')
         self.stats = Statistics()
+        self.stats.staged_memory_peak = self.staged_memory_size
+
+    def handle_uploaded_batches(self):
+        """Moves the position to the last acknowledged batch, raises if an
+        upload failed"""
+        acknowledged = self.upload_pipeline.pop_acknowledged()
+        if acknowledged is not None:
+            self.state.last_processed_transaction = acknowledged[0]
+            self.save_state_if_required()
+
+        for uploaded_table_name, size, seconds in self.upload_pipeline.pop_upload_times():
+            self.upload_scheduler.uploaded(uploaded_table_name, size, seconds)
 
     def upload_records_if_required(self, table_name):
-        need_dump = False
-        if table_name is not None:
-            if len(self.records_to_insert[table_name]) >= DbReplicator.DATA_DUMP_BATCH_SIZE:
-                need_dump = True
-            if len(self.records_to_delete[table_name]) >= DbReplicator.DATA_DUMP_BATCH_SIZE:
-                need_dump = True
+        self.handle_uploaded_batches()
 
         curr_time = time.time()
-        if curr_time - self.last_records_upload_time >= DbReplicator.DATA_DUMP_INTERVAL:
-            need_dump = True
-
-        if not need_dump:
-            return
+        due_tables, memory_limit_reached = self.upload_scheduler.due_tables(
+            table_name, curr_time, self.staging_memory.size,
+        )
+        if memory_limit_reached:
+            # a catch-up burst spread over many tables, put() blocks while
+            # the upload queue is full
+            self.stats.memory_limit_uploads_count += 1
+
+        if not due_tables:
+            # with nothing staged the position can still be behind, after
+            # events without records
+            if self.upload_scheduler.has_staged():
+                return
+            if self.state.last_processed_transaction_non_uploaded == self.last_uploaded_transaction:
+                return
+            if curr_time - self.last_records_upload_time < self.config.db_replicator.upload_max_delay:
+                return
 
         self.last_records_upload_time = curr_time
 
-        for table_name, id_to_records in self.records_to_insert.items():
-            records = id_to_records.values()
-            if not records:
-                continue
-            self.clickhouse_api.insert(table_name, records)
-
-        for table_name, keys_to_remove in self.records_to_delete.items():
-            if not keys_to_remove:
-                continue
-            table_structure: TableStructure = self.state.tables_structure[table_name][0]
-            primary_key_name = table_structure.primary_key
-            self.clickhouse_api.erase(
-                table_name=table_name,
-                field_name=primary_key_name,
-                field_values=keys_to_remove,
-            )
+        batch = UploadBatch(
+            records_to_insert={},
+            records_to_delete={},
+            transaction_id=None,
+        )
+        for due_table_name in due_tables:
+            records, record_versions, keys_to_remove, key_versions = self.staged_tables[due_table_name].take()
+            if records:
+                batch.records_to_insert[due_table_name] = (records, record_versions)
+            if keys_to_remove:
+                batch.records_to_delete[due_table_name] = (keys_to_remove, key_versions)
+            staged_size, transaction_range = self.upload_scheduler.take(due_table_name)
+            batch.table_sizes[due_table_name] = staged_size
+            batch.table_ranges[due_table_name] = transaction_range
+            self.staged_memory_size -= staged_size
+            self.staging_memory.size -= staged_size
+        batch.transaction_id = self.upload_scheduler.checkpoint(self.state.last_processed_transaction_non_uploaded)
+        self.last_uploaded_transaction = batch.transaction_id
+        self.stats.upload_batches_count += 1
+        self.stats.uploaded_tables_count += len(due_tables)
+        # the position only moves once the batches before it are uploaded
+        self.upload_pipeline.put(batch)
+
+
+class MultiDbReplicator:
+    """Replicates several databases in one process instead of a process per
+    database: the upload workers and their ClickHouse connections are
+    shared, and so is staging_memory_limit. Every database keeps its own
+    event reader, upload order and state (position).
+
+    The initial replication of the databases runs in background threads,
+    a database joins the realtime replication once it is done. One thread
+    then handles the events of all the databases in turns of up to
+    EVENTS_PER_TURN events each: the databases with a backlog share the
+    thread evenly, a burst in one of them doesn't delay the others by more
+    than a turn."""
+
+    EVENTS_PER_TURN = 1000
+    INITIAL_REPLICATION_WORKERS = 4
+    # without a shared log there is no single dir to watch for new events
+    IDLE_WAIT_TIMEOUT = 0.1
+
+    def __init__(self, config: Settings, databases: list[str]):
+        self.config = config
+        self.client_pool = ClickhouseClientPool(config.clickhouse)
+        self.upload_executor = ThreadPoolExecutor(
+            max_workers=max(config.clickhouse.upload_workers, 1), thread_name_prefix='clickhouse-upload-table',
+        )
+        self.staging_memory = StagingMemory()
+        self.replicators = [
+            DbReplicator(config, database, self.client_pool, self.upload_executor, self.staging_memory)
+            for database in databases
+        ]
 
-        self.records_to_insert = defaultdict(dict)  # table_name => {record_id=>record, ...}
-        self.records_to_delete = defaultdict(set)  # table_name => {record_id, ...}
-        self.state.last_processed_transaction = self.state.last_processed_transaction_non_uploaded
-        self.save_state_if_required()
+    def run(self):
+        initial_replication_executor = ThreadPoolExecutor(
+            max_workers=MultiDbReplicator.INITIAL_REPLICATION_WORKERS, thread_name_prefix='initial-replication',
+        )
+        pending = {
+            initial_replication_executor.submit(replicator.replicate_initial_data): replicator
+            for replicator in self.replicators
+        }
+        running: list[DbReplicator] = []
+        while True:
+            for future in [future for future in pending if future.done()]:
+                replicator = pending.pop(future)
+                future.result()
+                replicator.start_realtime_replication()
+                running.append(replicator)
+                if not pending:
+                    initial_replication_executor.shutdown()
+
+            events_count = 0
+            for replicator in running:
+                # a database behind on uploads would block the turns of the
+                # others, its position still moves (and a failed upload,
+                # after which the queue stays full, is raised)
+                if replicator.upload_pipeline.is_full():
+                    replicator.handle_uploaded_batches()
+                    continue
+                events_count += replicator.process_events(MultiDbReplicator.EVENTS_PER_TURN)
+            if events_count == 0:
+                self.wait_for_events(running)
+
+    def wait_for_events(self, running: list[DbReplicator]):
+        if running and self.config.binlog_replicator.shared_log:
+            # the readers watch the same files
+            running[0].data_reader.wait_for_events(DbReplicator.READ_WAIT_TIMEOUT)
+            return
+        time.sleep(MultiDbReplicator.IDLE_WAIT_TIMEOUT)
@@ -4,7 +4,7 @@ import argparse
 import logging
 
 from config import Settings
-from db_replicator import DbReplicator
+from db_replicator import DbReplicator, MultiDbReplicator
 from binlog_replicator import BinlogReplicator
 from monitoring import Monitoring
 
@@ -16,16 +16,27 @@ def run_binlog_replicator(args, config: Settings):
     binlog_replicator = BinlogReplicator(
         mysql_settings=config.mysql,
         replicator_settings=config.binlog_replicator,
+        databases=config.databases,
     )
     binlog_replicator.run()
 
 def run_db_replicator(args, config: Settings):
-    if not args.db:
+    databases = [db.strip() for db in (args.db or '').split(',') if db.strip()]
+    if not databases:
         raise Exception("need to pass --db argument")
 
+    if len(databases) > 1:
+        # one process for all of them, see MultiDbReplicator
+        db_replicator = MultiDbReplicator(
+            config=config,
+            databases=databases,
+        )
+        db_replicator.run()
+        return
+
     db_replicator = DbReplicator(
         config=config,
-        database=args.db,
+        database=databases[0],
     )
     db_replicator.run()
 
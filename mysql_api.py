@@ -19,6 +19,10 @@ class MySQLApi:
         if database is not None:
             self.cursor.execute(f'USE {database}')
 
+    def close(self):
+        self.cursor.close()
+        self.db.close()
+
     def get_tables(self):
         self.cursor.execute('SHOW TABLES')
         res = self.cursor.fetchall()
@@ -0,0 +1,216 @@
+import os
+import logging
+
+from pymysql.protocol import MysqlPacket
+
+from .constants.BINLOG import TABLE_MAP_EVENT, ROTATE_EVENT, FORMAT_DESCRIPTION_EVENT
+from .cpp_accelerated import NativeBinlogFile, NativeEventFilter
+from .packet import BinLogPacketWrapper
+from .row_event import TableMapEvent
+from .event import RotateEvent
+from .binlogstream import allowed_event_list
+
+# events start right after the magic bytes
+BINLOG_FIRST_EVENT_POS = 4
+
+
+class OfflineControlConnection(object):
+    """Stands in for the control connection when there is no server:
+    provides what the decoders read from it"""
+
+    def __init__(self, charset, dbms):
+        self.charset = charset
+        self.dbms = dbms
+
+    def _get_dbms(self):
+        return self.dbms
+
+
+def get_binlog_files(log_dir):
+    """Binlog files (e.g. mysql-bin.000042) in log_dir, in binlog order"""
+    result = []
+    for file_name in os.listdir(log_dir):
+        base, _, suffix = file_name.rpartition(".")
+        if base and suffix.isdigit():
+            result.append(file_name)
+    return sorted(result, key=lambda name: int(name.rpartition(".")[2]))
+
+
+class BinLogFileStreamReader(object):
+    """Reads MySQL binlog files from a directory (e.g. a backup) through the
+    same decoders as BinLogStreamReader, without a MySQL server.
+
+    Files are mmapped by the native library, events are framed and filtered
+    natively before python objects are created. log_file / log_pos follow
+    the same semantics as in BinLogStreamReader, so a live stream can be
+    resumed from where the files end.
+    """
+
+    def __init__(
+        self,
+        log_dir,
+        log_file=None,
+        log_pos=None,
+        only_events=None,
+        ignored_events=None,
+        filter_non_implemented_events=True,
+        only_tables=None,
+        ignored_tables=None,
+        only_schemas=None,
+        ignored_schemas=None,
+        freeze_schema=False,
+        ignore_decode_errors=False,
+        verify_checksum=False,
+        optional_meta_data=True,
+        charset="utf8",
+        dbms="mysql",
+    ):
+        """
+        Attributes:
+            log_dir: Directory with binlog files
+            log_file: File to start from, the first file in log_dir if not set
+            log_pos: Position inside log_file to start from
+            optional_meta_data: Binlogs were written with binlog_row_metadata=FULL,
+                                column names are taken from the table map events
+            charset: Connection charset the events are decoded with
+            dbms: "mysql" or "mariadb"
+
+        The remaining attributes are the same as in BinLogStreamReader.
+        """
+        self.log_dir = log_dir
+        self.log_file = log_file
+        self.log_pos = log_pos
+        self.table_map = {}
+        self.mysql_version = (0, 0, 0)
+
+        self.__only_tables = only_tables
+        self.__ignored_tables = ignored_tables
+        self.__only_schemas = only_schemas
+        self.__ignored_schemas = ignored_schemas
+        self.__freeze_schema = freeze_schema
+        self.__ignore_decode_errors = ignore_decode_errors
+        self.__verify_checksum = verify_checksum
+        self.__optional_meta_data = optional_meta_data
+        self.__allowed_events = allowed_event_list(
+            only_events, ignored_events, filter_non_implemented_events
+        )
+        self.__allowed_events_in_packet = frozenset(
+            [TableMapEvent, RotateEvent]
+        ).union(self.__allowed_events)
+        self.__event_filter = NativeEventFilter(
+            event_types=BinLogPacketWrapper.event_types_for(
+                self.__allowed_events_in_packet
+            ),
+            only_schemas=only_schemas,
+            ignored_schemas=ignored_schemas,
+            only_tables=only_tables,
+            ignored_tables=ignored_tables,
+        )
+        self._ctl_connection = OfflineControlConnection(charset, dbms)
+        self.__current_file = None
+
+    def close(self):
+        if self.__current_file is not None:
+            self.__current_file.close()
+            self.__current_file = None
+
+    def __open_next_file(self):
+        files = get_binlog_files(self.log_dir)
+        if self.__current_file is None:
+            if self.log_file is None:
+                if not files:
+                    return False
+                self.log_file = files[0]
+                self.log_pos = BINLOG_FIRST_EVENT_POS
+            file_name = self.log_file
+        else:
+            current_name = os.path.basename(self.__current_file.file_path)
+            next_files = []
+            if current_name in files:
+                next_files = files[files.index(current_name) + 1 :]
+            self.__current_file.close()
+            self.__current_file = None
+            if not next_files:
+                return False
+            file_name = next_files[0]
+            self.log_file = file_name
+            self.log_pos = BINLOG_FIRST_EVENT_POS
+            # table ids are only valid within a binlog file
+            self.table_map = {}
+
+        logging.info(f"reading binlog file {file_name}")
+        self.__current_file = NativeBinlogFile(os.path.join(self.log_dir, file_name))
+        if self.log_pos:
+            self.__current_file.seek(self.log_pos)
+        return True
+
+    def __read_packet(self):
+        while True:
+            if self.__current_file is None and not self.__open_next_file():
+                return None
+            result = self.__current_file.next_packet()
+            if result is not None:
+                return result[1]
+            if not self.__open_next_file():
+                return None
+
+    def fetchone(self):
+        while True:
+            data = self.__read_packet()
+            if data is None:
+                self.close()
+                return None
+
+            use_checksum = self.__current_file.checksum_enabled
+            self.__event_filter.set_verify_checksum(
+                use_checksum and self.__verify_checksum
+            )
+            if not self.__event_filter.check(data):
+                header = self.__event_filter.header
+                if header.log_pos:
+                    self.log_pos = header.log_pos
+                continue
+
+            binlog_event = BinLogPacketWrapper(
+                MysqlPacket(data, self._ctl_connection.charset),
+                self.table_map,
+                self._ctl_connection,
+                self.mysql_version,
+                use_checksum,
+                self.__allowed_events_in_packet,
+                self.__only_tables,
+                self.__ignored_tables,
+                self.__only_schemas,
+                self.__ignored_schemas,
+                self.__freeze_schema,
+                self.__ignore_decode_errors,
+                self.__verify_checksum,
+                self.__optional_meta_data,
+                self.__event_filter.header.checksum_state,
+            )
+
+            # The next file is picked from the directory listing (see
+            # __open_next_file), the position of a rotate event points into it
+            if binlog_event.event_type != ROTATE_EVENT and binlog_event.log_pos:
+                self.log_pos = binlog_event.log_pos
+
+            if (
+                binlog_event.event_type == TABLE_MAP_EVENT
+                and binlog_event.event is not None
+            ):
+                self.table_map[binlog_event.event.table_id] = (
+                    binlog_event.event.get_table()
+                )
+
+            if binlog_event.event is None or (
+                binlog_event.event.__class__ not in self.__allowed_events
+            ):
+                continue
+
+            if binlog_event.event_type == FORMAT_DESCRIPTION_EVENT:
+                self.mysql_version = binlog_event.event.mysql_version
+
+            return binlog_event.event
+
+    def __iter__(self):
+        return iter(self.fetchone, None)
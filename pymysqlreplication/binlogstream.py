@@ -32,6 +32,7 @@ from .event import (
 from .exceptions import BinLogNotEnabled
 from .gtid import GtidSet
 from .packet import BinLogPacketWrapper
+from .cpp_accelerated import NativeEventFilter
 from .row_event import (
     UpdateRowsEvent,
     WriteRowsEvent,
@@ -154,6 +155,51 @@ class ReportSlave(object):
         )
 
 
+def allowed_event_list(only_events, ignored_events, filter_non_implemented_events):
+    """Event classes a reader returns for these only/ignored events settings"""
+    if only_events is not None:
+        events = set(only_events)
+    else:
+        events = set(
+            (
+                QueryEvent,
+                RotateEvent,
+                StopEvent,
+                FormatDescriptionEvent,
+                XAPrepareEvent,
+                XidEvent,
+                GtidEvent,
+                BeginLoadQueryEvent,
+                ExecuteLoadQueryEvent,
+                UpdateRowsEvent,
+                WriteRowsEvent,
+                DeleteRowsEvent,
+                TableMapEvent,
+                HeartbeatLogEvent,
+                NotImplementedEvent,
+                MariadbGtidEvent,
+                RowsQueryLogEvent,
+                MariadbAnnotateRowsEvent,
+                RandEvent,
+                MariadbStartEncryptionEvent,
+                MariadbGtidListEvent,
+                MariadbBinLogCheckPointEvent,
+                UserVarEvent,
+                PreviousGtidsEvent,
+                PartialUpdateRowsEvent,
+            )
+        )
+    if ignored_events is not None:
+        for e in ignored_events:
+            events.remove(e)
+    if filter_non_implemented_events:
+        try:
+            events.remove(NotImplementedEvent)
+        except KeyError:
+            pass
+    return frozenset(events)
+
+
 class BinLogStreamReader(object):
     """Connect to replication stream and read event"""
 
@@ -188,6 +234,7 @@ class BinLogStreamReader(object):
         ignore_decode_errors=False,
         verify_checksum=False,
         enable_logging=True,
+        native_event_filter=False,
     ):
         """
         Attributes:
@@ -230,6 +277,9 @@ class BinLogStreamReader(object):
             verify_checksum: If true, verify events read from the binary log by examining checksums.
             enable_logging: When set to True, logs various details helpful for debugging and monitoring
                             When set to False, logging is disabled to enhance performance.
+            native_event_filter: If true, event type and schema/table filters are applied
+                                 in native code on the raw packet, before any python
+                                 object is created for the event.
         """
 
         self.__connection_settings = connection_settings
@@ -291,6 +341,18 @@ class BinLogStreamReader(object):
         self.mysql_version = (0, 0, 0)
         self.dbms = None
 
+        self.__event_filter = None
+        if native_event_filter:
+            self.__event_filter = NativeEventFilter(
+                event_types=BinLogPacketWrapper.event_types_for(
+                    self.__allowed_events_in_packet
+                ),
+                only_schemas=only_schemas,
+                ignored_schemas=ignored_schemas,
+                only_tables=only_tables,
+                ignored_tables=ignored_tables,
+            )
+
     def close(self):
         if self.__connected_stream:
             self._stream_connection.close()
@@ -349,6 +411,10 @@ class BinLogStreamReader(object):
         self._stream_connection = self.pymysql_wrapper(**self.__connection_settings)
 
         self.__use_checksum = self.__checksum_enabled()
+        if self.__event_filter is not None:
+            self.__event_filter.set_verify_checksum(
+                self.__use_checksum and self.__verify_checksum
+            )
 
         # If checksum is enabled we need to inform the server about the that
         # we support it
@@ -615,6 +681,21 @@ class BinLogStreamReader(object):
             if not pkt.is_ok_packet():
                 continue
 
+            if self.__event_filter is not None and not self.__event_filter.check(
+                pkt._data
+            ):
+                # Skipped without decoding, only the position is tracked
+                header = self.__event_filter.header
+                if header.log_pos:
+                    self.log_pos = header.log_pos
+                if self.end_log_pos and self.log_pos >= self.end_log_pos:
+                    self.is_past_end_log_pos = True
+                continue
+
+            checksum_state = None
+            if self.__event_filter is not None:
+                checksum_state = self.__event_filter.header.checksum_state
+
             binlog_event = BinLogPacketWrapper(
                 pkt,
                 self.table_map,
@@ -630,6 +711,7 @@ class BinLogStreamReader(object):
                 self.__ignore_decode_errors,
                 self.__verify_checksum,
                 self.__optional_meta_data,
+                checksum_state,
             )
 
             if binlog_event.event_type == ROTATE_EVENT:
@@ -707,47 +789,9 @@ class BinLogStreamReader(object):
     def _allowed_event_list(
         self, only_events, ignored_events, filter_non_implemented_events
     ):
-        if only_events is not None:
-            events = set(only_events)
-        else:
-            events = set(
-                (
-                    QueryEvent,
-                    RotateEvent,
-                    StopEvent,
-                    FormatDescriptionEvent,
-                    XAPrepareEvent,
-                    XidEvent,
-                    GtidEvent,
-                    BeginLoadQueryEvent,
-                    ExecuteLoadQueryEvent,
-                    UpdateRowsEvent,
-                    WriteRowsEvent,
-                    DeleteRowsEvent,
-                    TableMapEvent,
-                    HeartbeatLogEvent,
-                    NotImplementedEvent,
-                    MariadbGtidEvent,
-                    RowsQueryLogEvent,
-                    MariadbAnnotateRowsEvent,
-                    RandEvent,
-                    MariadbStartEncryptionEvent,
-                    MariadbGtidListEvent,
-                    MariadbBinLogCheckPointEvent,
-                    UserVarEvent,
-                    PreviousGtidsEvent,
-                    PartialUpdateRowsEvent,
-                )
-            )
-        if ignored_events is not None:
-            for e in ignored_events:
-                events.remove(e)
-        if filter_non_implemented_events:
-            try:
-                events.remove(NotImplementedEvent)
-            except KeyError:
-                pass
-        return frozenset(events)
+        return allowed_event_list(
+            only_events, ignored_events, filter_non_implemented_events
+        )
 
     def __get_dbms(self):
         if not self.__connected_ctl:
@@ -1,7 +1,8 @@
 import platform
 import ctypes
-from ctypes import c_int, c_char_p
+from ctypes import c_int, c_char_p, c_size_t, c_ssize_t, c_void_p, c_uint8, c_uint16, c_uint32, c_uint64, c_ulong, py_object, POINTER
 import os
+import sys
 
 MODULE_DIR = os.path.dirname(__file__)
 
@@ -14,8 +15,16 @@ if platform.system() == 'Linux':
     FILE_PATH = f'{FILE_NAME}.so'
 
 FILE_PATH = os.path.join(MODULE_DIR, FILE_PATH)
+if not os.path.exists(FILE_PATH):
+    raise ImportError(
+        f'{FILE_PATH} not found, build it with: '
+        f'cmake -S binlog_json_parser -B binlog_json_parser/build && cmake --build binlog_json_parser/build'
+    )
 
 lib = ctypes.cdll.LoadLibrary(FILE_PATH)
+# same library, for the functions that work with python objects: called with
+# the GIL held and raise the python exception they set
+pylib = ctypes.PyDLL(FILE_PATH)
 
 test_func = lib.test_func
 test_func.argtypes = ()
@@ -30,5 +39,663 @@ mysql_to_json.argtypes = (c_char_p,c_int)
 mysql_to_json.restype = c_char_p
 
 
-def cpp_mysql_to_json(data: bytes) -> bytes:
-    return mysql_to_json(c_char_p(data), c_int(len(data)))
+mysql_to_json_range = lib.mysql_to_json_range
+mysql_to_json_range.argtypes = (c_char_p, c_size_t, c_size_t)
+mysql_to_json_range.restype = c_char_p
+
+bitmap_bit_count = lib.bitmap_bit_count
+bitmap_bit_count.argtypes = (c_char_p, c_size_t)
+bitmap_bit_count.restype = c_size_t
+
+row_bitmaps_expand = lib.row_bitmaps_expand
+row_bitmaps_expand.argtypes = (c_char_p, c_char_p, c_size_t, c_char_p)
+row_bitmaps_expand.restype = c_size_t
+
+
+
+class BinlogEventHeader(ctypes.Structure):
+    _pack_ = 1
+    _fields_ = [
+        ("timestamp", c_uint32),
+        ("event_type", c_uint8),
+        ("server_id", c_uint32),
+        ("event_size", c_uint32),
+        ("log_pos", c_uint32),
+        ("flags", c_uint16),
+        ("checksum_state", c_uint8),
+    ]
+
+
+# BinlogEventHeader.checksum_state values
+BINLOG_CHECKSUM_NOT_CHECKED = 0
+BINLOG_CHECKSUM_VALID = 1
+BINLOG_CHECKSUM_INVALID = 2
+
+crc32_checksum = lib.crc32_checksum
+crc32_checksum.argtypes = (c_char_p, c_size_t, c_size_t)
+crc32_checksum.restype = c_uint32
+
+binlog_event_checksum_state = lib.binlog_event_checksum_state
+binlog_event_checksum_state.argtypes = (c_char_p, c_size_t)
+binlog_event_checksum_state.restype = c_int
+
+
+binlog_filter_create = lib.binlog_filter_create
+binlog_filter_create.argtypes = ()
+binlog_filter_create.restype = c_void_p
+
+binlog_filter_destroy = lib.binlog_filter_destroy
+binlog_filter_destroy.argtypes = (c_void_p,)
+binlog_filter_destroy.restype = None
+
+binlog_filter_set_verify_checksum = lib.binlog_filter_set_verify_checksum
+binlog_filter_set_verify_checksum.argtypes = (c_void_p, c_int)
+binlog_filter_set_verify_checksum.restype = None
+
+binlog_filter_allow_event_type = lib.binlog_filter_allow_event_type
+binlog_filter_allow_event_type.argtypes = (c_void_p, c_int)
+binlog_filter_allow_event_type.restype = None
+
+binlog_filter_allow_all_event_types = lib.binlog_filter_allow_all_event_types
+binlog_filter_allow_all_event_types.argtypes = (c_void_p,)
+binlog_filter_allow_all_event_types.restype = None
+
+binlog_filter_enable_only = lib.binlog_filter_enable_only
+binlog_filter_enable_only.argtypes = (c_void_p, c_int, c_int)
+binlog_filter_enable_only.restype = None
+
+binlog_filter_add_schema = lib.binlog_filter_add_schema
+binlog_filter_add_schema.argtypes = (c_void_p, c_char_p, c_size_t, c_int)
+binlog_filter_add_schema.restype = None
+
+binlog_filter_add_table = lib.binlog_filter_add_table
+binlog_filter_add_table.argtypes = (c_void_p, c_char_p, c_size_t, c_int)
+binlog_filter_add_table.restype = None
+
+binlog_filter_check = lib.binlog_filter_check
+binlog_filter_check.argtypes = (c_void_p, c_char_p, c_size_t, POINTER(BinlogEventHeader))
+binlog_filter_check.restype = c_int
+
+binlog_file_open = lib.binlog_file_open
+binlog_file_open.argtypes = (c_char_p, c_char_p, c_size_t)
+binlog_file_open.restype = c_void_p
+
+binlog_file_close = lib.binlog_file_close
+binlog_file_close.argtypes = (c_void_p,)
+binlog_file_close.restype = None
+
+binlog_file_next = lib.binlog_file_next
+binlog_file_next.argtypes = (c_void_p, POINTER(c_uint64), POINTER(c_uint32))
+binlog_file_next.restype = c_int
+
+binlog_file_seek = lib.binlog_file_seek
+binlog_file_seek.argtypes = (c_void_p, c_uint64)
+binlog_file_seek.restype = None
+
+binlog_file_data = lib.binlog_file_data
+binlog_file_data.argtypes = (c_void_p,)
+binlog_file_data.restype = c_void_p
+
+binlog_file_checksum_enabled = lib.binlog_file_checksum_enabled
+binlog_file_checksum_enabled.argtypes = (c_void_p,)
+binlog_file_checksum_enabled.restype = c_int
+
+event_log_codec_available = lib.event_log_codec_available
+event_log_codec_available.argtypes = (c_int,)
+event_log_codec_available.restype = c_int
+
+event_log_writer_open = lib.event_log_writer_open
+event_log_writer_open.argtypes = (c_char_p, c_int, c_size_t, c_char_p, c_size_t)
+event_log_writer_open.restype = c_void_p
+
+event_log_writer_close = lib.event_log_writer_close
+event_log_writer_close.argtypes = (c_void_p,)
+event_log_writer_close.restype = None
+
+event_log_writer_append = lib.event_log_writer_append
+event_log_writer_append.argtypes = (
+    c_void_p, c_char_p, c_size_t, c_char_p, c_size_t, c_char_p, c_size_t, c_char_p, c_size_t,
+)
+event_log_writer_append.restype = c_int
+
+event_log_writer_flush = lib.event_log_writer_flush
+event_log_writer_flush.argtypes = (c_void_p, c_char_p, c_size_t)
+event_log_writer_flush.restype = c_int
+
+event_log_writer_sync = lib.event_log_writer_sync
+event_log_writer_sync.argtypes = (c_void_p, c_char_p, c_size_t)
+event_log_writer_sync.restype = c_int
+
+event_log_writer_finish = lib.event_log_writer_finish
+event_log_writer_finish.argtypes = (c_void_p, c_char_p, c_size_t)
+event_log_writer_finish.restype = c_int
+
+event_log_writer_size = lib.event_log_writer_size
+event_log_writer_size.argtypes = (c_void_p,)
+event_log_writer_size.restype = c_uint64
+
+event_log_reader_open = lib.event_log_reader_open
+event_log_reader_open.argtypes = (c_char_p, c_char_p, c_size_t, c_char_p, c_size_t)
+event_log_reader_open.restype = c_void_p
+
+event_log_reader_close = lib.event_log_reader_close
+event_log_reader_close.argtypes = (c_void_p,)
+event_log_reader_close.restype = None
+
+event_log_reader_next = lib.event_log_reader_next
+event_log_reader_next.argtypes = (c_void_p, POINTER(c_void_p), POINTER(c_uint32), c_char_p, c_size_t)
+event_log_reader_next.restype = c_int
+
+event_log_reader_seek = lib.event_log_reader_seek
+event_log_reader_seek.argtypes = (c_void_p, c_uint64, c_char_p, c_size_t)
+event_log_reader_seek.restype = c_int
+
+event_log_reader_finished = lib.event_log_reader_finished
+event_log_reader_finished.argtypes = (c_void_p,)
+event_log_reader_finished.restype = c_int
+
+event_log_reader_index = lib.event_log_reader_index
+event_log_reader_index.argtypes = (c_void_p, c_char_p, c_size_t)
+event_log_reader_index.restype = ctypes.c_int64
+
+event_log_reader_index_entry = lib.event_log_reader_index_entry
+event_log_reader_index_entry.argtypes = (
+    c_void_p, c_size_t, POINTER(c_uint64), POINTER(c_uint32), POINTER(c_void_p), POINTER(c_size_t),
+    POINTER(c_void_p), POINTER(c_size_t), POINTER(c_void_p), POINTER(c_size_t),
+)
+event_log_reader_index_entry.restype = None
+
+event_log_reader_last_key = lib.event_log_reader_last_key
+event_log_reader_last_key.argtypes = (c_void_p, POINTER(c_void_p), POINTER(c_size_t), c_char_p, c_size_t)
+event_log_reader_last_key.restype = c_int
+
+event_log_compact = lib.event_log_compact
+event_log_compact.argtypes = (c_char_p, c_char_p, c_int, c_size_t, c_char_p, c_size_t)
+event_log_compact.restype = c_int
+
+dir_watcher_open = lib.dir_watcher_open
+dir_watcher_open.argtypes = (c_char_p, c_char_p, c_size_t)
+dir_watcher_open.restype = c_void_p
+
+dir_watcher_close = lib.dir_watcher_close
+dir_watcher_close.argtypes = (c_void_p,)
+dir_watcher_close.restype = None
+
+dir_watcher_wait = lib.dir_watcher_wait
+dir_watcher_wait.argtypes = (c_void_p, c_int, c_char_p, c_size_t)
+dir_watcher_wait.restype = c_int
+
+# first bytes of files written by NativeEventLogWriter
+EVENT_LOG_MAGIC = b'CHEL'
+
+# event log block compression codecs
+EVENT_LOG_CODECS = {
+    'none': 0,
+    'lz4': 1,
+    'zstd': 2,
+    'zlib': 3,
+}
+EVENT_LOG_DEFAULT_BLOCK_SIZE = 1 << 20
+
+event_log_encode = pylib.event_log_encode
+event_log_encode.argtypes = (py_object, py_object, py_object, py_object, py_object)
+event_log_encode.restype = py_object
+
+event_log_decode = pylib.event_log_decode
+event_log_decode.argtypes = (c_char_p, c_size_t)
+event_log_decode.restype = py_object
+
+event_log_reader_next_event = pylib.event_log_reader_next_event
+event_log_reader_next_event.argtypes = (c_void_p,)
+event_log_reader_next_event.restype = py_object
+
+clickhouse_type_supported = lib.clickhouse_type_supported
+clickhouse_type_supported.argtypes = (c_char_p,)
+clickhouse_type_supported.restype = c_int
+
+clickhouse_encode_native = pylib.clickhouse_encode_native
+clickhouse_encode_native.argtypes = (py_object, py_object, py_object, py_object)
+clickhouse_encode_native.restype = py_object
+
+# the staging table holds python objects, all its calls need the GIL
+staging_table_create = pylib.staging_table_create
+staging_table_create.argtypes = ()
+staging_table_create.restype = c_void_p
+
+staging_table_free = pylib.staging_table_free
+staging_table_free.argtypes = (c_void_p,)
+staging_table_free.restype = None
+
+staging_table_apply = pylib.staging_table_apply
+staging_table_apply.argtypes = (c_void_p, py_object, c_ssize_t, c_int, c_uint64)
+staging_table_apply.restype = c_ssize_t
+
+staging_table_take = pylib.staging_table_take
+staging_table_take.argtypes = (c_void_p,)
+staging_table_take.restype = py_object
+
+staging_table_insert_count = pylib.staging_table_insert_count
+staging_table_insert_count.argtypes = (c_void_p,)
+staging_table_insert_count.restype = c_size_t
+
+staging_table_delete_count = pylib.staging_table_delete_count
+staging_table_delete_count.argtypes = (c_void_p,)
+staging_table_delete_count.restype = c_size_t
+
+event_codec_python_version = lib.event_codec_python_version
+event_codec_python_version.argtypes = ()
+event_codec_python_version.restype = c_ulong
+
+# column states produced by cpp_expand_row_bitmaps
+ROW_COLUMN_PRESENT = 0
+ROW_COLUMN_NULL = 1
+ROW_COLUMN_MISSING = 2
+
+
+def cpp_mysql_to_json(data: bytes, offset: int = 0, size: int | None = None) -> bytes:
+    if size is None:
+        size = len(data) - offset
+    # the payload is parsed in place, no slice of `data` is created
+    return mysql_to_json_range(data, offset, size)
+
+
+def cpp_crc32(data: bytes, offset: int = 0, size: int | None = None) -> int:
+    if size is None:
+        size = len(data) - offset
+    return crc32_checksum(data, offset, size)
+
+
+def cpp_event_checksum_state(packet_data: bytes) -> int:
+    """Verify the CRC32 footer of the event in a replication packet"""
+    return binlog_event_checksum_state(packet_data, len(packet_data))
+
+
+def check_event_codec_python_version():
+    # the codec is compiled against the python headers, objects
+    # are laid out differently in other versions
+    built_for = event_codec_python_version() >> 16
+    if built_for != sys.hexversion >> 16:
+        raise RuntimeError(
+            f'{FILE_PATH} is built for python {built_for >> 8}.{built_for & 0xff}, '
+            f'rebuild it with -DPython3_EXECUTABLE={sys.executable}'
+        )
+
+
+def cpp_encode_event(transaction_id, db_name: str, table_name: str, records: list, is_removal: bool) -> bytes:
+    """Encode a binlog replicator event into the columnar event log payload"""
+    return event_log_encode(transaction_id, db_name, table_name, records, is_removal)
+
+
+def cpp_decode_event(payload: bytes) -> tuple:
+    """Returns (transaction_id, db_name, table_name, records, is_removal)"""
+    return event_log_decode(payload, len(payload))
+
+
+def cpp_clickhouse_type_supported(clickhouse_type: str) -> bool:
+    return clickhouse_type_supported(clickhouse_type.encode()) != 0
+
+
+def cpp_encode_clickhouse_native(records, column_names: list[str], column_types: list[str], versions: int | bytes) -> bytes:
+    """A Native format block of the records (sequences of column values)
+    with a `_version` column, for INSERT ... FORMAT Native. `versions` is
+    the version of the first record, the next ones are numbered from it,
+    or the version of every record as bytes of native uint64"""
+    return clickhouse_encode_native(records, column_names, column_types, versions)
+
+
+def cpp_bitmap_count(bitmap: bytes) -> int:
+    return bitmap_bit_count(bitmap, len(bitmap))
+
+
+class RowBitmapExpander:
+    """Expands the bitmaps of the rows of an event into one ROW_COLUMN_*
+    state per column, in a buffer allocated once and reused for every row"""
+
+    def __init__(self, column_count: int):
+        self.column_count = column_count
+        self.bitmap_size = (column_count + 7) // 8
+        self.states = bytearray(column_count)
+        self._states_buffer = (ctypes.c_char * column_count).from_buffer(self.states)
+
+    def expand(self, cols_bitmap: bytes, null_bitmap: bytes) -> bytearray:
+        """The returned states are overwritten by the next call"""
+        if len(cols_bitmap) < self.bitmap_size:
+            cols_bitmap = cols_bitmap.ljust(self.bitmap_size, b'\x00')
+        row_bitmaps_expand(cols_bitmap, null_bitmap, self.column_count, self._states_buffer)
+        return self.states
+
+
+def cpp_expand_row_bitmaps(cols_bitmap: bytes, null_bitmap: bytes, column_count: int) -> bytes:
+    return bytes(RowBitmapExpander(column_count).expand(cols_bitmap, null_bitmap))
+
+
+class NativeEventFilter:
+    """Drops binlog events before any python object is created for them.
+
+    `check` takes the raw replication packet (OK byte + event header + body)
+    and fills `header`, which stays valid for skipped events too.
+    """
+
+    def __init__(
+        self,
+        event_types=None,
+        only_schemas=None,
+        ignored_schemas=None,
+        only_tables=None,
+        ignored_tables=None,
+    ):
+        self._handle = binlog_filter_create()
+        self.header = BinlogEventHeader()
+        self._header_ref = ctypes.byref(self.header)
+        if event_types is None:
+            binlog_filter_allow_all_event_types(self._handle)
+        else:
+            for event_type in event_types:
+                binlog_filter_allow_event_type(self._handle, event_type)
+        binlog_filter_enable_only(self._handle, only_schemas is not None, only_tables is not None)
+        for names, add_func, ignored in (
+            (only_schemas, binlog_filter_add_schema, 0),
+            (ignored_schemas, binlog_filter_add_schema, 1),
+            (only_tables, binlog_filter_add_table, 0),
+            (ignored_tables, binlog_filter_add_table, 1),
+        ):
+            for name in names or ():
+                name = name.encode() if isinstance(name, str) else name
+                add_func(self._handle, name, len(name), ignored)
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            binlog_filter_destroy(self._handle)
+            self._handle = None
+
+    def set_verify_checksum(self, verify: bool):
+        binlog_filter_set_verify_checksum(self._handle, verify)
+
+    def check(self, packet_data: bytes) -> bool:
+        return binlog_filter_check(self._handle, packet_data, len(packet_data), self._header_ref) != 0
+
+
+class NativeBinlogFile:
+    """MySQL binlog file mapped into memory by the native library.
+
+    `next_packet` returns events in the replication packet layout used by
+    BinLogPacketWrapper (one leading byte + event), or None at the end of
+    the file or at a partially written trailing event.
+    """
+
+    ERROR_BUFFER_SIZE = 1024
+
+    def __init__(self, file_path: str):
+        error = ctypes.create_string_buffer(NativeBinlogFile.ERROR_BUFFER_SIZE)
+        self._handle = binlog_file_open(file_path.encode(), error, len(error))
+        if not self._handle:
+            raise OSError(error.value.decode())
+        self._base = binlog_file_data(self._handle)
+        self._offset = c_uint64()
+        self._size = c_uint32()
+        self.file_path = file_path
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            binlog_file_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def seek(self, position: int):
+        binlog_file_seek(self._handle, position)
+
+    @property
+    def checksum_enabled(self) -> bool:
+        return binlog_file_checksum_enabled(self._handle) != 0
+
+    def next_packet(self) -> tuple[int, bytes] | None:
+        if not binlog_file_next(self._handle, ctypes.byref(self._offset), ctypes.byref(self._size)):
+            return None
+        offset = self._offset.value
+        # Events start after the 4 magic bytes, so the byte in front of the
+        # event always exists. It stands in for the OK byte of a replication
+        # packet, which nothing reads, and saves a concatenation per event.
+        packet = ctypes.string_at(self._base + offset - 1, self._size.value + 1)
+        return offset, packet
+
+
+def cpp_event_log_codec_available(codec: str) -> bool:
+    return event_log_codec_available(EVENT_LOG_CODECS[codec]) != 0
+
+
+def cpp_compact_event_log(src_path: str, dst_path: str, codec: str, block_size: int):
+    """Writes the events of src_path to a new event log at dst_path with
+    blocks of about block_size bytes compressed with codec"""
+    error = ctypes.create_string_buffer(1024)
+    if not event_log_compact(
+        src_path.encode(), dst_path.encode(), EVENT_LOG_CODECS[codec], block_size, error, len(error),
+    ):
+        raise OSError(error.value.decode())
+
+
+class NativeEventLogWriter:
+    """Appends events to an event log file. Events are buffered into blocks
+    of about block_size bytes which are compressed with `codec` (a key of
+    EVENT_LOG_CODECS), readers only see events of written blocks.
+    The payload encoding is up to the caller, as are the keys: the keys of
+    the first and the last event of every block go to the block index, keys
+    have to grow bytewise for readers to binary search them.
+    Events of different tags (e.g. databases sharing a file) are buffered
+    into separate blocks, each tag has its own sequence of keys."""
+
+    ERROR_BUFFER_SIZE = 1024
+
+    def __init__(self, file_path: str, codec: str = 'lz4', block_size: int = EVENT_LOG_DEFAULT_BLOCK_SIZE):
+        self._error = ctypes.create_string_buffer(NativeEventLogWriter.ERROR_BUFFER_SIZE)
+        self._handle = event_log_writer_open(
+            file_path.encode(), EVENT_LOG_CODECS[codec], block_size, self._error, len(self._error),
+        )
+        if not self._handle:
+            raise OSError(self._error.value.decode())
+        self.file_path = file_path
+
+    def close(self):
+        """Writes the pending block and the index footer"""
+        if getattr(self, '_handle', None):
+            try:
+                if not event_log_writer_finish(self._handle, self._error, len(self._error)):
+                    raise OSError(self._error.value.decode())
+            finally:
+                event_log_writer_close(self._handle)
+                self._handle = None
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            # no footer, the file is still readable
+            event_log_writer_close(self._handle)
+            self._handle = None
+
+    def append(self, payload: bytes, key: bytes = b'', tag: bytes = b''):
+        if not event_log_writer_append(
+            self._handle, payload, len(payload), key, len(key), tag, len(tag),
+            self._error, len(self._error),
+        ):
+            raise OSError(self._error.value.decode())
+
+    def flush(self):
+        """Writes the pending block, even if it isn't full yet"""
+        if not event_log_writer_flush(self._handle, self._error, len(self._error)):
+            raise OSError(self._error.value.decode())
+
+    def sync(self):
+        """Writes the pending block and waits until the file data is on disk"""
+        if not event_log_writer_sync(self._handle, self._error, len(self._error)):
+            raise OSError(self._error.value.decode())
+
+    @property
+    def size(self) -> int:
+        return event_log_writer_size(self._handle)
+
+
+class NativeEventLogReader:
+    """Reads events written by NativeEventLogWriter. `next_payload` returns
+    None when there is no complete block left yet, it can be called again
+    once the writer appended more data.
+    With a tag only the events of that tag are read, the blocks of other
+    tags are skipped without being decompressed."""
+
+    ERROR_BUFFER_SIZE = 1024
+
+    def __init__(self, file_path: str, tag: bytes | None = None):
+        self._error = ctypes.create_string_buffer(NativeEventLogReader.ERROR_BUFFER_SIZE)
+        self._handle = event_log_reader_open(
+            file_path.encode(), tag, len(tag) if tag is not None else 0, self._error, len(self._error),
+        )
+        if not self._handle:
+            raise OSError(self._error.value.decode())
+        self._payload = c_void_p()
+        self._size = c_uint32()
+        self.file_path = file_path
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            event_log_reader_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def next_payload(self) -> bytes | None:
+        result = event_log_reader_next(
+            self._handle, ctypes.byref(self._payload), ctypes.byref(self._size),
+            self._error, len(self._error),
+        )
+        if result < 0:
+            raise OSError(self._error.value.decode())
+        if result == 0:
+            return None
+        return ctypes.string_at(self._payload.value, self._size.value)
+
+    def next_event(self) -> tuple | None:
+        """Same as cpp_decode_event(next_payload()) for files of encoded
+        events, decoded straight from the file mapping without copying
+        the payload"""
+        return event_log_reader_next_event(self._handle)
+
+    def seek(self, block_offset: int):
+        """Continue reading from the block at block_offset (see read_index)"""
+        if not event_log_reader_seek(self._handle, block_offset, self._error, len(self._error)):
+            raise OSError(self._error.value.decode())
+
+    @property
+    def finished(self) -> bool:
+        """next_payload reached the footer of the file, the writer is done
+        with it"""
+        return bool(event_log_reader_finished(self._handle))
+
+    def read_index(self) -> list[tuple[int, int, bytes, bytes, bytes]]:
+        """[(block offset, event count, key of the first event, key of the last
+        event, tag), ...] of the written blocks of all tags"""
+        count = event_log_reader_index(self._handle, self._error, len(self._error))
+        if count < 0:
+            raise OSError(self._error.value.decode())
+        offset = c_uint64()
+        event_count = c_uint32()
+        first_key = c_void_p()
+        first_key_size = c_size_t()
+        last_key = c_void_p()
+        last_key_size = c_size_t()
+        tag = c_void_p()
+        tag_size = c_size_t()
+        result = []
+        for position in range(count):
+            event_log_reader_index_entry(
+                self._handle, position, ctypes.byref(offset), ctypes.byref(event_count),
+                ctypes.byref(first_key), ctypes.byref(first_key_size),
+                ctypes.byref(last_key), ctypes.byref(last_key_size),
+                ctypes.byref(tag), ctypes.byref(tag_size),
+            )
+            result.append((
+                offset.value,
+                event_count.value,
+                ctypes.string_at(first_key.value, first_key_size.value),
+                ctypes.string_at(last_key.value, last_key_size.value),
+                ctypes.string_at(tag.value, tag_size.value),
+            ))
+        return result
+
+    def read_last_key(self) -> bytes | None:
+        """Key of the last written event (of the tag of the reader), None if
+        there are no events yet"""
+        key = c_void_p()
+        key_size = c_size_t()
+        result = event_log_reader_last_key(
+            self._handle, ctypes.byref(key), ctypes.byref(key_size), self._error, len(self._error),
+        )
+        if result < 0:
+            raise OSError(self._error.value.decode())
+        if result == 0:
+            return None
+        return ctypes.string_at(key.value, key_size.value)
+
+
+class NativeDirWatcher:
+    """Waits for files in a directory to be created or appended to
+    (inotify on Linux), the GIL is released while waiting."""
+
+    ERROR_BUFFER_SIZE = 1024
+
+    def __init__(self, dir_path: str):
+        self._error = ctypes.create_string_buffer(NativeDirWatcher.ERROR_BUFFER_SIZE)
+        self._handle = dir_watcher_open(dir_path.encode(), self._error, len(self._error))
+        if not self._handle:
+            raise OSError(self._error.value.decode())
+        self.dir_path = dir_path
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            dir_watcher_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def wait(self, timeout: float) -> bool:
+        """True if something changed, False after timeout seconds without changes"""
+        result = dir_watcher_wait(self._handle, int(timeout * 1000), self._error, len(self._error))
+        if result < 0:
+            raise OSError(self._error.value.decode())
+        return result == 1
+
+
+class NativeStagingTable:
+    """Records of a table waiting for upload, deduplicated by primary key in
+    a native hash map: the last record of a key wins in place, a deleted
+    key is kept as a delete."""
+
+    def __init__(self):
+        self._handle = staging_table_create()
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            staging_table_free(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def apply(self, records, key_index: int, is_removal: bool, first_version: int) -> int:
+        """Stage the records of an event (the key at key_index) with the
+        versions first_version, first_version + 1, ..., returns how many
+        keys weren't staged before"""
+        return staging_table_apply(self._handle, records, key_index, 1 if is_removal else 0, first_version)
+
+    def take(self) -> tuple[list, bytes, list, bytes]:
+        """(records, their versions, deleted keys, their versions), versions
+        as bytes of native uint64. The table is empty afterwards."""
+        return staging_table_take(self._handle)
+
+    @property
+    def insert_count(self) -> int:
+        return staging_table_insert_count(self._handle)
+
+    @property
+    def delete_count(self) -> int:
+        return staging_table_delete_count(self._handle)
@@ -2,12 +2,16 @@ import binascii
 import struct
 import datetime
 import decimal
-import zlib
 import logging
 
 from pymysqlreplication.constants.STATUS_VAR_KEY import *
 from pymysqlreplication.exceptions import StatusVariableMismatch
 from pymysqlreplication.util.bytes import parse_decimal_from_bytes
+from pymysqlreplication.cpp_accelerated import (
+    cpp_event_checksum_state,
+    BINLOG_CHECKSUM_NOT_CHECKED,
+    BINLOG_CHECKSUM_VALID,
+)
 from typing import Union, Optional
 import json
 
@@ -56,18 +60,15 @@ class BinLogEvent(object):
         if not self._verify_checksum:
             return
 
-        self.packet.rewind(1)
-        data = self.packet.read(19 + self.event_size)
-        footer = self.packet.read(4)
-        byte_data = zlib.crc32(data).to_bytes(4, byteorder="little")
-        self._is_event_valid = True if byte_data == footer else False
+        checksum_state = self.packet.checksum_state
+        if checksum_state in (None, BINLOG_CHECKSUM_NOT_CHECKED):
+            checksum_state = cpp_event_checksum_state(self.packet.packet._data)
+        self._is_event_valid = checksum_state == BINLOG_CHECKSUM_VALID
         if not self._is_event_valid:
             logging.error(
                 f"An CRC32 has failed for the event type {self.event_type}, "
                 "indicating a potential integrity issue with the data."
             )
-        self.packet.read_bytes -= 19 + self.event_size + 4
-        self.packet.rewind(20)
 
     @property
     def formatted_timestamp(self) -> str:
@@ -15,6 +15,24 @@ UNSIGNED_SHORT_LENGTH = 2
 UNSIGNED_INT24_LENGTH = 3
 UNSIGNED_INT64_LENGTH = 8
 
+STRUCT_INT8 = struct.Struct("<b")
+STRUCT_UINT8 = struct.Struct("<B")
+STRUCT_INT16 = struct.Struct("<h")
+STRUCT_UINT16 = struct.Struct("<H")
+STRUCT_UINT24 = struct.Struct("<HB")
+STRUCT_INT32 = struct.Struct("<i")
+STRUCT_UINT32 = struct.Struct("<I")
+STRUCT_UINT40 = struct.Struct("<BI")
+STRUCT_UINT48 = struct.Struct("<HHH")
+STRUCT_UINT56 = struct.Struct("<BHI")
+STRUCT_INT64 = struct.Struct("<q")
+STRUCT_UINT64 = struct.Struct("<Q")
+STRUCT_INT16_BE = struct.Struct(">h")
+STRUCT_UINT24_BE = struct.Struct(">BH")
+STRUCT_INT32_BE = struct.Struct(">i")
+STRUCT_INT40_BE = struct.Struct(">IB")
+STRUCT_INT64_BE = struct.Struct(">q")
+
 
 class BinLogPacketWrapper(object):
     """
@@ -59,6 +77,18 @@ class BinLogPacketWrapper(object):
         constants.MARIADB_START_ENCRYPTION_EVENT: event.MariadbStartEncryptionEvent,
     }
 
+    @classmethod
+    def event_types_for(cls, event_classes):
+        """Return the binlog event types decoded into one of `event_classes`,
+        or None when unknown event types have to be decoded as well"""
+        if event.NotImplementedEvent in event_classes:
+            return None
+        return [
+            event_type
+            for event_type, event_class in cls.__event_map.items()
+            if event_class in event_classes
+        ]
+
     def __init__(
         self,
         from_packet,
@@ -75,14 +105,20 @@ class BinLogPacketWrapper(object):
         ignore_decode_errors,
         verify_checksum,
         optional_meta_data,
+        checksum_state=None,
     ):
         # -1 because we ignore the ok byte
         self.read_bytes = 0
         # Used when we want to override a value in the data buffer
         self.__data_buffer = b""
+        # All reads below are offset arithmetic over the packet payload;
+        # the packet position is the single cursor shared with the events.
+        self.__data = from_packet._data
 
         self.packet = from_packet
         self.charset = ctl_connection.charset
+        # set when the checksum was already verified during native framing
+        self.checksum_state = checksum_state
 
         # OK value
         # timestamp
@@ -144,6 +180,26 @@ class BinLogPacketWrapper(object):
                 return data + self.packet.read(size - len(data))
         return self.packet.read(size)
 
+    def read_buffer_range(self, size):
+        """Consume 'size' bytes and return (payload, offset) so that native
+        decoders can work directly on the packet payload"""
+        size = int(size)
+        if len(self.__data_buffer) > 0:
+            return self.read(size), 0
+        position = self.packet._position
+        self.packet.advance(size)
+        self.read_bytes += size
+        return self.__data, position
+
+    def __unpack(self, fmt, size):
+        if len(self.__data_buffer) > 0:
+            return fmt.unpack(self.read(size))
+        position = self.packet._position
+        result = fmt.unpack_from(self.__data, position)
+        self.packet._position = position + size
+        self.read_bytes += size
+        return result
+
     def unread(self, data):
         """Push again data in data buffer. It's use when you want
         to extract a bit from a value a let the rest of the code normally
@@ -170,17 +226,17 @@ class BinLogPacketWrapper(object):
 
         From PyMYSQL source code
         """
-        c = struct.unpack("!B", self.read(1))[0]
+        c = self.read_uint8()
         if c == NULL_COLUMN:
             return None
         if c < UNSIGNED_CHAR_COLUMN:
             return c
         elif c == UNSIGNED_SHORT_COLUMN:
-            return self.unpack_uint16(self.read(UNSIGNED_SHORT_LENGTH))
+            return self.read_uint16()
         elif c == UNSIGNED_INT24_COLUMN:
-            return self.unpack_int24(self.read(UNSIGNED_INT24_LENGTH))
+            return self.read_uint24()
         elif c == UNSIGNED_INT64_COLUMN:
-            return self.unpack_int64(self.read(UNSIGNED_INT64_LENGTH))
+            return self.read_uint64()
 
     def read_length_coded_string(self):
         """Read a 'Length Coded String' from the data buffer.
@@ -205,17 +261,17 @@ class BinLogPacketWrapper(object):
     def read_int_be_by_size(self, size):
         """Read a big endian integer values based on byte number"""
         if size == 1:
-            return struct.unpack(">b", self.read(size))[0]
+            return self.__unpack(STRUCT_INT8, 1)[0]
         elif size == 2:
-            return struct.unpack(">h", self.read(size))[0]
+            return self.__unpack(STRUCT_INT16_BE, 2)[0]
         elif size == 3:
             return self.read_int24_be()
         elif size == 4:
-            return struct.unpack(">i", self.read(size))[0]
+            return self.__unpack(STRUCT_INT32_BE, 4)[0]
         elif size == 5:
             return self.read_int40_be()
         elif size == 8:
-            return struct.unpack(">l", self.read(size))[0]
+            return self.__unpack(STRUCT_INT64_BE, 8)[0]
 
     def read_uint_by_size(self, size):
         """Read a little endian integer values based on byte number"""
@@ -254,65 +310,65 @@ class BinLogPacketWrapper(object):
         length = 0
         bits_read = 0
         while byte & 0x80 != 0:
-            byte = struct.unpack("!B", self.read(1))[0]
+            byte = self.read_uint8()
             length = length | ((byte & 0x7F) << bits_read)
             bits_read = bits_read + 7
         return self.read(length)
 
     def read_int24(self):
-        a, b, c = struct.unpack("BBB", self.read(3))
-        res = a | (b << 8) | (c << 16)
+        low, high = self.__unpack(STRUCT_UINT24, 3)
+        res = low | (high << 16)
         if res >= 0x800000:
             res -= 0x1000000
         return res
 
     def read_int24_be(self):
-        a, b, c = struct.unpack("BBB", self.read(3))
-        res = (a << 16) | (b << 8) | c
+        high, low = self.__unpack(STRUCT_UINT24_BE, 3)
+        res = (high << 16) | low
         if res >= 0x800000:
             res -= 0x1000000
         return res
 
     def read_uint8(self):
-        return struct.unpack("<B", self.read(1))[0]
+        return self.__unpack(STRUCT_UINT8, 1)[0]
 
     def read_int16(self):
-        return struct.unpack("<h", self.read(2))[0]
+        return self.__unpack(STRUCT_INT16, 2)[0]
 
     def read_uint16(self):
-        return struct.unpack("<H", self.read(2))[0]
+        return self.__unpack(STRUCT_UINT16, 2)[0]
 
     def read_uint24(self):
-        a, b, c = struct.unpack("<BBB", self.read(3))
-        return a + (b << 8) + (c << 16)
+        low, high = self.__unpack(STRUCT_UINT24, 3)
+        return low + (high << 16)
 
     def read_uint32(self):
-        return struct.unpack("<I", self.read(4))[0]
+        return self.__unpack(STRUCT_UINT32, 4)[0]
 
     def read_int32(self):
-        return struct.unpack("<i", self.read(4))[0]
+        return self.__unpack(STRUCT_INT32, 4)[0]
 
     def read_uint40(self):
-        a, b = struct.unpack("<BI", self.read(5))
+        a, b = self.__unpack(STRUCT_UINT40, 5)
         return a + (b << 8)
 
     def read_int40_be(self):
-        a, b = struct.unpack(">IB", self.read(5))
+        a, b = self.__unpack(STRUCT_INT40_BE, 5)
         return b + (a << 8)
 
     def read_uint48(self):
-        a, b, c = struct.unpack("<HHH", self.read(6))
+        a, b, c = self.__unpack(STRUCT_UINT48, 6)
         return a + (b << 16) + (c << 32)
 
     def read_uint56(self):
-        a, b, c = struct.unpack("<BHI", self.read(7))
+        a, b, c = self.__unpack(STRUCT_UINT56, 7)
         return a + (b << 8) + (c << 24)
 
     def read_uint64(self):
-        return struct.unpack("<Q", self.read(8))[0]
+        return self.__unpack(STRUCT_UINT64, 8)[0]
 
     def read_int64(self):
-        return struct.unpack("<q", self.read(8))[0]
+        return self.__unpack(STRUCT_INT64, 8)[0]
 
     def unpack_uint16(self, n):
         return struct.unpack("<H", n[0:2])[0]
@@ -346,8 +402,8 @@ class BinLogPacketWrapper(object):
         if length == 0:
             # handle NULL value
             return None
-        data = self.read(length)
-        return cpp_mysql_to_json(data)
+        data, offset = self.read_buffer_range(length)
+        return cpp_mysql_to_json(data, offset, length)
 
         #
         # if is_partial:
@@ -378,13 +434,21 @@ class BinLogPacketWrapper(object):
         Returns:
             Binary string parsed from __data_buffer
         """
-        string = b""
-        while True:
-            char = self.read(1)
-            if char == b"\0":
-                break
-            string += char
-
+        if len(self.__data_buffer) > 0:
+            string = b""
+            while True:
+                char = self.read(1)
+                if char == b"\0":
+                    break
+                string += char
+            return string
+
+        position = self.packet._position
+        end = self.__data.find(b"\0", position)
+        if end < 0:
+            raise AssertionError(f"missing string terminator at position {position}")
+        string = self.__data[position:end]
+        self.advance(end - position + 1)
         return string
 
     def bytes_to_read(self):
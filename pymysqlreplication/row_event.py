@@ -12,7 +12,13 @@ from .constants import CHARSET
 from .constants import NONE_SOURCE
 from .column import Column
 from .table import Table
-from .bitmap import BitCount, BitGet
+from .bitmap import BitGet
+from .cpp_accelerated import (
+    cpp_bitmap_count,
+    RowBitmapExpander,
+    ROW_COLUMN_MISSING,
+    ROW_COLUMN_NULL,
+)
 
 
 class RowsEvent(BinLogEvent):
@@ -24,6 +30,8 @@ class RowsEvent(BinLogEvent):
         self.__only_schemas = kwargs["only_schemas"]
         self.__ignored_schemas = kwargs["ignored_schemas"]
         self.__none_sources = {}
+        self.__bitmap_expander = None
+        self.__column_names = None
 
         # Header
         self.table_id = self._read_table_id()
@@ -93,13 +101,6 @@ class RowsEvent(BinLogEvent):
         self.number_of_columns = self.packet.read_length_coded_binary()
         self.columns = self.table_map[self.table_id].columns
 
-    @staticmethod
-    def _is_null(null_bitmap, position):
-        bit = null_bitmap[int(position / 8)]
-        if isinstance(bit, str):
-            bit = ord(bit)
-        return bit & (1 << (position % 8))
-
     def _read_column_data(self, cols_bitmap, row_image_type=None):
         """Use for WRITE, UPDATE and DELETE events.
         Return an array of column data
@@ -118,16 +119,32 @@ class RowsEvent(BinLogEvent):
 
         # null bitmap length = (bits set in 'columns-present-bitmap'+7)/8
         # See http://dev.mysql.com/doc/internals/en/rows-event.html
-        null_bitmap = self.packet.read((BitCount(cols_bitmap) + 7) / 8)
+        null_bitmap = self.packet.read((cpp_bitmap_count(cols_bitmap) + 7) / 8)
 
-        null_bitmap_index = 0
-        partial_bitmap_index = 0
+        # Both bitmaps are expanded once per row, so the loop below only
+        # decodes columns that are present and not null. The states buffer
+        # is shared by the rows of the event.
         nb_columns = len(self.columns)
+        table_columns = self.table_map[self.table_id].columns
+        if self.__bitmap_expander is None:
+            self.__bitmap_expander = RowBitmapExpander(nb_columns)
+            # If you are using mysql 5.7 or mysql 8, but binlog_row_metadata = "MINIMAL",
+            # we do not know the column information.
+            # If you know column information,
+            # mysql 5.7 version Users Use Under 1.0 version
+            # mysql 8.0 version Users Set binlog_row_metadata = "FULL"
+            self.__column_names = [
+                table_columns[i].name or "UNKNOWN_COL" + str(i)
+                for i in range(nb_columns)
+            ]
+        column_states = self.__bitmap_expander.expand(cols_bitmap, null_bitmap)
+        column_names = self.__column_names
+
+        partial_bitmap_index = 0
         for i in range(0, nb_columns):
             is_partial = False
             column = self.columns[i]
-            name = self.table_map[self.table_id].columns[i].name
-            unsigned = self.table_map[self.table_id].columns[i].unsigned
+            name = column_names[i]
 
             if (
                 self.is_partial_json_update
@@ -138,48 +155,35 @@ class RowsEvent(BinLogEvent):
                     is_partial = True
                 partial_bitmap_index += 1
 
-            if not name:
-                # If you are using mysql 5.7 or mysql 8, but binlog_row_metadata = "MINIMAL",
-                # we do not know the column information.
-                # If you know column information,
-                # mysql 5.7 version Users Use Under 1.0 version
-                # mysql 8.0 version Users Set binlog_row_metadata = "FULL"
-                name = "UNKNOWN_COL" + str(i)
+            column_state = column_states[i]
+            if column_state == ROW_COLUMN_MISSING:
+                # This block is only executed when binlog_row_image = MINIMAL.
+                # When binlog_row_image = FULL, this block does not execute.
+                self.__none_sources[table_columns[i].name] = NONE_SOURCE.COLS_BITMAP
+                values[name] = None
+                continue
+            if column_state == ROW_COLUMN_NULL:
+                self.__none_sources[table_columns[i].name] = NONE_SOURCE.NULL
+                values[name] = None
+                continue
+
             values[name] = self.__read_values_name(
                 column,
-                null_bitmap,
-                null_bitmap_index,
                 is_partial,
-                cols_bitmap,
-                unsigned,
+                table_columns[i].unsigned,
                 i,
             )
 
-            if BitGet(cols_bitmap, i) != 0:
-                null_bitmap_index += 1
-
         return values
 
     def __read_values_name(
         self,
         column,
-        null_bitmap,
-        null_bitmap_index,
         is_partial,
-        cols_bitmap,
         unsigned,
         i,
     ):
         name = self.table_map[self.table_id].columns[i].name
-        if BitGet(cols_bitmap, i) == 0:
-            # This block is only executed when binlog_row_image = MINIMAL.
-            # When binlog_row_image = FULL, this block does not execute.
-            self.__none_sources[name] = NONE_SOURCE.COLS_BITMAP
-            return None
-
-        if self._is_null(null_bitmap, null_bitmap_index):
-            self.__none_sources[name] = NONE_SOURCE.NULL
-            return None
 
         if column.type == FIELD_TYPE.TINY:
             if unsigned:
@@ -792,7 +796,7 @@ class TableMapEvent(BinLogEvent):
             self.columns.append(col)
 
         # ith column is nullable if (i - 1)th bit is set to True, not nullable otherwise
-        ## Refer to definition of and call to row.event._is_null() to interpret bitmap corresponding to columns
+        ## Refer to bitmap.BitGet() to interpret bitmap corresponding to columns
         self.null_bitmask = self.packet.read((self.column_count + 7) / 8)
         self.table_obj = Table(self.table_id, self.schema, self.table, self.columns)
         table_map[self.table_id] = self.table_obj
@@ -0,0 +1,33 @@
+# This is a sample script in order to make benchmark
+# on library speed without a MySQL server: it replays
+# binlog files from a directory (e.g. a backup).
+#
+# usage: python benchmark_binlog_files.py <binlog dir> [first binlog file]
+
+import sys
+import time
+from pymysqlreplication.binlogfilestream import BinLogFileStreamReader
+from pymysqlreplication.row_event import *
+
+
+def consume_events(log_dir, log_file):
+    stream = BinLogFileStreamReader(
+        log_dir,
+        log_file=log_file,
+        only_events=[WriteRowsEvent, UpdateRowsEvent, DeleteRowsEvent],
+    )
+    start = time.perf_counter()
+    events = 0
+    rows = 0
+    for binlogevent in stream:
+        events += 1
+        rows += len(binlogevent.rows)
+        if events % 10000 == 0:
+            print(f"{rows / (time.perf_counter() - start)} rows by seconds ({rows} total)")
+
+    duration = time.perf_counter() - start
+    print(f"{events} events, {rows} rows in {duration:.2f}s, {rows / duration} rows by seconds")
+    print(f"stopped at {stream.log_file}:{stream.log_pos}")
+
+
+consume_events(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else None)
@@ -0,0 +1,87 @@
+# Measures how fast records are serialized for ClickHouse inserts: the
+# native Native format encoder against clickhouse_connect (if installed).
+# Both run on one thread, MB/s are per core (process cpu time).
+#
+# usage: python pymysqlreplication/tests/benchmark_clickhouse_encode.py [records] [batches]
+
+import datetime
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..'))
+
+from pymysqlreplication.cpp_accelerated import cpp_encode_clickhouse_native
+
+
+COLUMN_NAMES = ['id', 'name', 'score', 'amount', 'birthday', 'created_at', 'active']
+COLUMN_TYPES = [
+    'Int32', 'String', 'Float64', 'Nullable(Int32)', 'Date32', 'DateTime64(6)', 'Bool',
+]
+
+
+def make_records(record_count):
+    records = []
+    for record_id in range(record_count):
+        records.append((
+            record_id,
+            f'user name {record_id}',
+            record_id * 1.5,
+            None if record_id % 7 == 0 else record_id % 1000,
+            datetime.date(1990, 1, 1) + datetime.timedelta(days=record_id % 10000),
+            datetime.datetime(2024, 1, 1) + datetime.timedelta(seconds=record_id),
+            record_id % 2 == 0,
+        ))
+    return records
+
+
+def encode_native(records):
+    return len(cpp_encode_clickhouse_native(records, COLUMN_NAMES, COLUMN_TYPES, 1))
+
+
+def make_clickhouse_connect_encoder():
+    try:
+        from clickhouse_connect.datatypes.registry import get_from_name
+        from clickhouse_connect.driver.insert import InsertContext
+        from clickhouse_connect.driver.transform import NativeTransform
+    except ImportError:
+        return None
+    column_types = [get_from_name(name) for name in COLUMN_TYPES + ['UInt64']]
+    transform = NativeTransform()
+
+    def encode(records):
+        # what ClickhouseApi.insert did before: a tuple per record with the version
+        data = [tuple(record) + (version,) for version, record in enumerate(records, 1)]
+        context = InsertContext('benchmark', COLUMN_NAMES + ['_version'], column_types, data)
+        return sum(len(chunk) for chunk in transform.build_insert(context))
+    return encode
+
+
+def measure(name, encode, records, batches):
+    size = 0
+    start = time.process_time()
+    for _ in range(batches):
+        size += encode(records)
+    duration = time.process_time() - start
+    record_count = len(records) * batches
+    print(
+        f'{name:<20} {duration:7.3f}s {record_count / duration:12.0f} records/s '
+        f'{size / 1e6 / duration:8.1f} MB/s per core'
+    )
+
+
+def main():
+    record_count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+    batches = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+    records = make_records(record_count)
+
+    measure('native', encode_native, records, batches)
+    clickhouse_connect_encode = make_clickhouse_connect_encoder()
+    if clickhouse_connect_encode is None:
+        print('clickhouse_connect is not installed, skipped')
+    else:
+        measure('clickhouse_connect', clickhouse_connect_encode, records, batches)
+
+
+if __name__ == '__main__':
+    main()
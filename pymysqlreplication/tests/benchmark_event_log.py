@@ -0,0 +1,114 @@
+# Compares the binlog replicator event log format with the previous
+# pickle-per-event format on synthetic row events.
+#
+# usage: python pymysqlreplication/tests/benchmark_event_log.py [events] [rows per event]
+
+import datetime
+import decimal
+import os
+import pickle
+import struct
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..'))
+
+from binlog_replicator import LogEvent, FileWriter, FileReader
+from pymysqlreplication.cpp_accelerated import EVENT_LOG_CODECS, cpp_event_log_codec_available
+
+
+def make_events(event_count, rows_per_event):
+    events = []
+    for event_idx in range(event_count):
+        records = []
+        for row_idx in range(rows_per_event):
+            record_id = event_idx * rows_per_event + row_idx
+            records.append([
+                record_id,
+                f'user name {record_id}',
+                record_id * 1.5,
+                None if record_id % 7 == 0 else record_id % 1000,
+                decimal.Decimal(record_id) / 100,
+                datetime.datetime(2024, 1, 1) + datetime.timedelta(seconds=record_id),
+                b'\x00\x01' * 8,
+            ])
+        events.append(LogEvent(
+            transaction_id=('mysql-bin.000042', 1000 + event_idx * 500),
+            db_name='benchmark_db',
+            table_name='users',
+            records=records,
+        ))
+    return events
+
+
+def write_pickle(file_path, events):
+    with open(file_path, 'wb') as f:
+        for event in events:
+            data = pickle.dumps(event)
+            f.write(struct.pack('>I', len(data)) + data)
+
+
+def read_pickle(file_path):
+    count = 0
+    with open(file_path, 'rb') as f:
+        while True:
+            size_data = f.read(4)
+            if len(size_data) < 4:
+                break
+            pickle.loads(f.read(struct.unpack('>I', size_data)[0]))
+            count += 1
+    return count
+
+
+def write_event_log(file_path, events, compression):
+    writer = FileWriter(file_path, compression)
+    for event in events:
+        writer.write_event(event)
+    writer.close()
+
+
+def read_event_log(file_path):
+    reader = FileReader(file_path)
+    count = 0
+    while reader.read_next_event() is not None:
+        count += 1
+    reader.close()
+    return count
+
+
+def measure(name, func, file_path, event_count):
+    start = time.perf_counter()
+    func()
+    duration = time.perf_counter() - start
+    size_mb = os.path.getsize(file_path) / 1e6
+    print(
+        f'{name:<16} {duration:7.3f}s {event_count / duration:10.0f} events/s '
+        f'{size_mb / duration:8.1f} MB/s  file {size_mb:.1f} MB'
+    )
+
+
+def main():
+    event_count = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    rows_per_event = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+    events = make_events(event_count, rows_per_event)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        pickle_path = os.path.join(tmp_dir, '1.pickle')
+        measure('pickle write', lambda: write_pickle(pickle_path, events), pickle_path, event_count)
+        measure('pickle read', lambda: read_pickle(pickle_path), pickle_path, event_count)
+        for compression in EVENT_LOG_CODECS:
+            if not cpp_event_log_codec_available(compression):
+                continue
+            os.mkdir(os.path.join(tmp_dir, compression))
+            log_path = os.path.join(tmp_dir, compression, '1.bin')
+            measure(
+                f'{compression} write',
+                lambda: write_event_log(log_path, events, compression),
+                log_path, event_count,
+            )
+            measure(f'{compression} read', lambda: read_event_log(log_path), log_path, event_count)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,627 @@
+import datetime
+import decimal
+import os
+import random
+import struct
+import tempfile
+import time
+import unittest
+import zlib
+
+from pymysqlreplication.bitmap import BitCount, BitGet
+from pymysqlreplication.constants import BINLOG
+from pymysqlreplication.cpp_accelerated import (
+    cpp_bitmap_count,
+    cpp_clickhouse_type_supported,
+    cpp_crc32,
+    cpp_encode_clickhouse_native,
+    cpp_decode_event,
+    cpp_encode_event,
+    cpp_compact_event_log,
+    cpp_event_log_codec_available,
+    EVENT_LOG_CODECS,
+    cpp_event_checksum_state,
+    cpp_mysql_to_json,
+    BINLOG_CHECKSUM_VALID,
+    BINLOG_CHECKSUM_INVALID,
+    NativeBinlogFile,
+    NativeDirWatcher,
+    NativeEventLogReader,
+    NativeEventLogWriter,
+    NativeEventFilter,
+    NativeStagingTable,
+    cpp_expand_row_bitmaps,
+    RowBitmapExpander,
+    ROW_COLUMN_PRESENT,
+    ROW_COLUMN_NULL,
+    ROW_COLUMN_MISSING,
+)
+
+
+class TestRowBitmaps(unittest.TestCase):
+    def test_bitmap_count(self):
+        for size in range(0, 40):
+            bitmap = os.urandom(size)
+            self.assertEqual(cpp_bitmap_count(bitmap), BitCount(bitmap))
+
+    def test_expand_full_row_image(self):
+        states = cpp_expand_row_bitmaps(b"\xff\x03", b"\x05\x00", 10)
+        self.assertEqual(
+            list(states),
+            [ROW_COLUMN_NULL, ROW_COLUMN_PRESENT, ROW_COLUMN_NULL] + [ROW_COLUMN_PRESENT] * 7,
+        )
+
+    def test_expand_minimal_row_image(self):
+        # only columns 1 and 9 are present, the second one is null
+        states = cpp_expand_row_bitmaps(b"\x02\x02", b"\x02", 12)
+        expected = [ROW_COLUMN_MISSING] * 12
+        expected[1] = ROW_COLUMN_PRESENT
+        expected[9] = ROW_COLUMN_NULL
+        self.assertEqual(list(states), expected)
+
+    def test_expand_matches_python(self):
+        rnd = random.Random(42)
+        for _ in range(200):
+            column_count = rnd.randint(1, 300)
+            cols_bitmap = bytes(rnd.getrandbits(8) for _ in range((column_count + 7) // 8))
+            present = [i for i in range(column_count) if BitGet(cols_bitmap, i)]
+            null_bitmap = bytes(rnd.getrandbits(8) for _ in range((len(present) + 7) // 8 or 1))
+
+            expected = [ROW_COLUMN_MISSING] * column_count
+            for null_idx, column in enumerate(present):
+                is_null = BitGet(null_bitmap, null_idx)
+                expected[column] = ROW_COLUMN_NULL if is_null else ROW_COLUMN_PRESENT
+
+            states = cpp_expand_row_bitmaps(cols_bitmap, null_bitmap, column_count)
+            self.assertEqual(list(states), expected)
+
+    def test_expander_reuses_states(self):
+        expander = RowBitmapExpander(10)
+        states = expander.expand(b"\xff\x03", b"\x05\x00")
+        self.assertEqual(states[:3], bytes([ROW_COLUMN_NULL, ROW_COLUMN_PRESENT, ROW_COLUMN_NULL]))
+        # the next row (of the other bitmap of an update) overwrites every state
+        self.assertIs(expander.expand(b"\x02", b"\x00"), states)
+        self.assertEqual(list(states), [ROW_COLUMN_MISSING, ROW_COLUMN_PRESENT] + [ROW_COLUMN_MISSING] * 8)
+
+
+class TestMysqlJson(unittest.TestCase):
+    JSON_DATA = bytes(
+        [0x0, 0x1, 0x0, 0x26, 0x0, 0xB, 0x0, 0x3, 0x0, 0x0, 0xE, 0x0, 0x66, 0x6F, 0x6F, 0x2, 0x0, 0x18, 0x0, 0x12,
+         0x0, 0x3, 0x0, 0x15, 0x0, 0x3, 0x0, 0x5, 0xA, 0x0, 0x5, 0x16, 0x0, 0x62, 0x61, 0x72, 0x6B, 0x72, 0x6F]
+    )
+
+    def test_parse(self):
+        self.assertEqual(cpp_mysql_to_json(self.JSON_DATA), b'{"foo": {"bar": 10, "kro": 22}}')
+
+    def test_parse_in_place(self):
+        payload = b"\x01\x02" + self.JSON_DATA + b"\x03"
+        result = cpp_mysql_to_json(payload, 2, len(self.JSON_DATA))
+        self.assertEqual(result, b'{"foo": {"bar": 10, "kro": 22}}')
+
+
+def set_local_timezone(test_case, timezone):
+    # POSIX TZ strings, they don't need the tz database
+    previous = os.environ.get("TZ")
+    os.environ["TZ"] = timezone
+    time.tzset()
+
+    def restore():
+        if previous is None:
+            os.environ.pop("TZ", None)
+        else:
+            os.environ["TZ"] = previous
+        time.tzset()
+    test_case.addCleanup(restore)
+
+
+def make_packet(event_type, body, log_pos=100, timestamp=1):
+    header = struct.pack("<IBIIIH", timestamp, event_type, 1, 19 + len(body), log_pos, 0)
+    return b"\x00" + header + body
+
+
+def make_table_map(table_id, schema, table):
+    body = struct.pack("<Q", table_id)[:6] + b"\x00\x00"
+    body += bytes([len(schema)]) + schema + b"\x00"
+    body += bytes([len(table)]) + table + b"\x00"
+    return make_packet(BINLOG.TABLE_MAP_EVENT, body)
+
+
+def make_rows(table_id, event_type=BINLOG.WRITE_ROWS_EVENT_V2):
+    return make_packet(event_type, struct.pack("<Q", table_id)[:6] + b"\x00" * 8)
+
+
+class TestNativeEventFilter(unittest.TestCase):
+    def test_header(self):
+        event_filter = NativeEventFilter()
+        self.assertTrue(event_filter.check(make_packet(BINLOG.XID_EVENT, b"\x00" * 8, log_pos=4242)))
+        self.assertEqual(event_filter.header.event_type, BINLOG.XID_EVENT)
+        self.assertEqual(event_filter.header.log_pos, 4242)
+        self.assertEqual(event_filter.header.event_size, 27)
+
+    def test_event_types(self):
+        event_filter = NativeEventFilter(event_types=[BINLOG.WRITE_ROWS_EVENT_V2])
+        self.assertFalse(event_filter.check(make_packet(BINLOG.XID_EVENT, b"\x00" * 8, log_pos=77)))
+        self.assertEqual(event_filter.header.log_pos, 77)
+        self.assertTrue(event_filter.check(make_packet(BINLOG.ROTATE_EVENT, b"\x00" * 8)))
+        self.assertTrue(event_filter.check(make_table_map(1, b"db", b"t")))
+        self.assertTrue(event_filter.check(make_rows(1)))
+        self.assertFalse(event_filter.check(make_rows(1, BINLOG.DELETE_ROWS_EVENT_V2)))
+
+    def test_schemas_and_tables(self):
+        event_filter = NativeEventFilter(only_schemas=["db1"], ignored_tables=["skip"])
+        self.assertTrue(event_filter.check(make_table_map(1, b"db1", b"t")))
+        self.assertFalse(event_filter.check(make_table_map(2, b"db2", b"t")))
+        self.assertFalse(event_filter.check(make_table_map(3, b"db1", b"skip")))
+        self.assertTrue(event_filter.check(make_rows(1)))
+        self.assertFalse(event_filter.check(make_rows(2)))
+        self.assertFalse(event_filter.check(make_rows(3)))
+        # unknown tables are left to the python decoder
+        self.assertTrue(event_filter.check(make_rows(4)))
+
+    def test_empty_only_schemas(self):
+        event_filter = NativeEventFilter(only_schemas=[])
+        self.assertFalse(event_filter.check(make_table_map(1, b"db1", b"t")))
+
+    def test_rotate_resets_tables(self):
+        event_filter = NativeEventFilter(only_schemas=["db1"])
+        self.assertFalse(event_filter.check(make_table_map(1, b"db2", b"t")))
+        self.assertFalse(event_filter.check(make_rows(1)))
+        self.assertTrue(event_filter.check(make_packet(BINLOG.ROTATE_EVENT, b"\x00" * 8, timestamp=0)))
+        self.assertFalse(event_filter.check(make_rows(1)))
+        self.assertTrue(event_filter.check(make_packet(BINLOG.ROTATE_EVENT, b"\x00" * 8)))
+        self.assertTrue(event_filter.check(make_rows(1)))
+
+
+class TestChecksum(unittest.TestCase):
+    # https://mariadb.com/kb/en/query_event/#example-with-crc32
+    QUERY_EVENT_PACKET = (
+        b"\x00"
+        b"q\x17(Z\x02\x8c'\x00\x00U\x00\x00\x00\x01\t\x00\x00\x00\x00"
+        b"f\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x1a\x00"
+        b"\x00\x00\x00\x00\x00\x01\x00\x00\x00P\x00\x00"
+        b"\x00\x00\x06\x03std\x04\x08\x00\x08\x00\x08\x00\x00"
+        b"TRUNCATE TABLE test.t4"
+        b"Ji\x9e\xed"
+    )
+
+    def test_crc32_matches_zlib(self):
+        rnd = random.Random(7)
+        for size in list(range(0, 200)) + [4096, 65537, 1 << 20]:
+            data = bytes(rnd.getrandbits(8) for _ in range(size))
+            self.assertEqual(cpp_crc32(data), zlib.crc32(data))
+            self.assertEqual(cpp_crc32(data, size // 3), zlib.crc32(data[size // 3 :]))
+
+    def test_event_checksum(self):
+        packet = self.QUERY_EVENT_PACKET
+        self.assertEqual(cpp_event_checksum_state(packet), BINLOG_CHECKSUM_VALID)
+        corrupted = packet[:1] + b"U" + packet[2:]
+        self.assertEqual(cpp_event_checksum_state(corrupted), BINLOG_CHECKSUM_INVALID)
+        self.assertEqual(cpp_event_checksum_state(packet[:10]), BINLOG_CHECKSUM_INVALID)
+
+    def test_filter_verifies_kept_events(self):
+        event_filter = NativeEventFilter()
+        event_filter.set_verify_checksum(True)
+        self.assertTrue(event_filter.check(self.QUERY_EVENT_PACKET))
+        self.assertEqual(event_filter.header.checksum_state, BINLOG_CHECKSUM_VALID)
+
+
+class TestNativeBinlogFile(unittest.TestCase):
+    def write_file(self, data):
+        f = tempfile.NamedTemporaryFile(suffix=".000001", delete=False)
+        f.write(data)
+        f.close()
+        self.addCleanup(os.unlink, f.name)
+        return f.name
+
+    def make_event(self, event_type, body, log_pos):
+        return make_packet(event_type, body, log_pos=log_pos)[1:]
+
+    def test_read_events(self):
+        fde_body = struct.pack("<H", 4) + b"8.0.36".ljust(50, b"\x00") + b"\x00" * 4 + b"\x13" + b"\x00" * 41
+        # checksum algorithm "none"
+        fde = self.make_event(BINLOG.FORMAT_DESCRIPTION_EVENT, fde_body + b"\x00", 0)
+        xid = self.make_event(BINLOG.XID_EVENT, b"\x01" * 8, 0)
+        data = b"\xfebin" + fde + xid + xid
+        # trailing event that is still being written
+        data += xid[:25]
+        binlog_file = NativeBinlogFile(self.write_file(data))
+
+        offset, packet = binlog_file.next_packet()
+        self.assertEqual(offset, 4)
+        self.assertEqual(packet[1:], fde)
+        self.assertFalse(binlog_file.checksum_enabled)
+        offset, packet = binlog_file.next_packet()
+        self.assertEqual(offset, 4 + len(fde))
+        self.assertEqual(packet[1:], xid)
+        self.assertIsNotNone(binlog_file.next_packet())
+        self.assertIsNone(binlog_file.next_packet())
+
+        binlog_file.seek(4 + len(fde) + len(xid))
+        self.assertEqual(binlog_file.next_packet()[1][1:], xid)
+        binlog_file.close()
+
+    def test_bad_magic(self):
+        with self.assertRaises(OSError):
+            NativeBinlogFile(self.write_file(b"\x00bin" + b"\x00" * 100))
+
+
+class TestEventLog(unittest.TestCase):
+    RECORDS = [
+        [1, "name", 1.5, b"\x00\x01", decimal.Decimal("-12.340"), datetime.datetime(1969, 12, 31, 23, 59, 59, 5),
+         datetime.date(2024, 2, 29), datetime.timedelta(hours=-838), None, {"a", "b"}, 2**64 - 1],
+        [-2**63, "", None, b"", None, datetime.datetime(9999, 12, 31), None,
+         datetime.timedelta(microseconds=1), None, None, 5],
+    ]
+
+    def make_file_path(self):
+        tmp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(tmp_dir.cleanup)
+        return os.path.join(tmp_dir.name, "1.bin")
+
+    def test_encode_decode(self):
+        payload = cpp_encode_event(("mysql-bin.000001", 4242), "db", "table", self.RECORDS, True)
+        transaction_id, db_name, table_name, records, is_removal = cpp_decode_event(payload)
+        self.assertEqual(transaction_id, ("mysql-bin.000001", 4242))
+        self.assertEqual((db_name, table_name, is_removal), ("db", "table", True))
+        self.assertEqual(records, self.RECORDS)
+        for record, expected in zip(records, self.RECORDS):
+            self.assertEqual(list(map(type, record)), list(map(type, expected)))
+
+    def test_untyped_values(self):
+        tz_aware = datetime.datetime(2024, 1, 1, tzinfo=datetime.timezone.utc)
+        records = [[tz_aware, "\udc80", 1], [None, "x", "mixed"]]
+        self.assertEqual(cpp_decode_event(cpp_encode_event(("f", 1), "db", "t", records, False))[3], records)
+        # rows of different sizes are pickled as a whole
+        records = [[1, 2], [3]]
+        self.assertEqual(cpp_decode_event(cpp_encode_event(("f", 1), "db", "t", records, False))[3], records)
+
+    def test_truncated_payload(self):
+        payload = cpp_encode_event(("f", 1), "db", "t", self.RECORDS, False)
+        for size in range(1, len(payload)):
+            with self.assertRaises(ValueError):
+                cpp_decode_event(payload[:size])
+
+    def test_writer_reader(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "zlib", block_size=64)
+        reader = NativeEventLogReader(file_path)
+        writer.append(b"first")
+        writer.append(b"")
+        # the block isn't written yet
+        self.assertIsNone(reader.next_payload())
+        writer.flush()
+        self.assertEqual(reader.next_payload(), b"first")
+        self.assertEqual(reader.next_payload(), b"")
+        self.assertIsNone(reader.next_payload())
+
+        # full blocks (two of these payloads) are written right away
+        payloads = [os.urandom(10) * 3 for _ in range(19)]
+        for payload in payloads:
+            writer.append(payload)
+        self.assertEqual([reader.next_payload() for _ in range(18)], payloads[:18])
+        self.assertIsNone(reader.next_payload())
+        self.assertFalse(reader.finished)
+        writer.close()
+        self.assertEqual(reader.next_payload(), payloads[18])
+        self.assertIsNone(reader.next_payload())
+        self.assertTrue(reader.finished)
+        reader.close()
+
+    def test_sync(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "none")
+        reader = NativeEventLogReader(file_path)
+        writer.append(b"payload")
+        writer.sync()
+        self.assertEqual(reader.next_payload(), b"payload")
+        writer.close()
+
+    def test_codecs(self):
+        payloads = [b"%d some repeated text" % i for i in range(1000)]
+        for codec in EVENT_LOG_CODECS:
+            if not cpp_event_log_codec_available(codec):
+                continue
+            file_path = self.make_file_path()
+            writer = NativeEventLogWriter(file_path, codec, block_size=4096)
+            for payload in payloads:
+                writer.append(payload)
+            writer.close()
+            if codec != "none":
+                self.assertLess(os.path.getsize(file_path), sum(map(len, payloads)) / 2)
+            reader = NativeEventLogReader(file_path)
+            self.assertEqual([reader.next_payload() for _ in payloads], payloads)
+            self.assertIsNone(reader.next_payload())
+
+    def test_index(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "zlib", block_size=100)
+        for i in range(50):
+            writer.append(b"event %d" % i, b"key %02d" % i)
+        writer.flush()
+        reader = NativeEventLogReader(file_path)
+        # walked from the block headers while the file is written
+        index = reader.read_index()
+        writer.close()
+        self.assertEqual(reader.read_index(), index)
+        self.assertEqual(sum(entry[1] for entry in index), 50)
+
+        offset, event_count, first_key, last_key, tag = index[2]
+        first_event = sum(entry[1] for entry in index[:2])
+        self.assertEqual(first_key, b"key %02d" % first_event)
+        self.assertEqual(last_key, b"key %02d" % (first_event + event_count - 1))
+        self.assertEqual(tag, b"")
+        reader.seek(offset)
+        self.assertEqual(reader.next_payload(), b"event %d" % first_event)
+
+    def test_last_key(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "zlib", block_size=100)
+        reader = NativeEventLogReader(file_path)
+        self.assertIsNone(reader.read_last_key())
+        for i in range(30):
+            writer.append(b"event %d" % i, b"key %02d" % i)
+        self.assertEqual(reader.read_last_key(), b"key 27")
+        writer.flush()
+        self.assertEqual(reader.read_last_key(), b"key 29")
+
+        # blocks written after the last block offset in the file header
+        # was updated are found as well
+        with open(file_path, "r+b") as f:
+            f.seek(8)
+            f.write(bytes(8))
+        self.assertEqual(reader.read_last_key(), b"key 29")
+        writer.close()
+        self.assertEqual(reader.read_last_key(), b"key 29")
+
+    def test_compact(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "none", block_size=10)
+        payloads = [b"event %d" % i for i in range(100)]
+        for i, payload in enumerate(payloads):
+            writer.append(payload, b"key %02d" % i)
+        writer.close()
+
+        compacted_path = file_path + ".compact"
+        cpp_compact_event_log(file_path, compacted_path, "zlib", 1 << 20)
+        self.assertLess(os.path.getsize(compacted_path), os.path.getsize(file_path) / 2)
+        reader = NativeEventLogReader(compacted_path)
+        self.assertEqual(reader.read_index(), [(16, 100, b"key 00", b"key 99", b"")])
+        self.assertEqual(reader.read_last_key(), b"key 99")
+        self.assertEqual([reader.next_payload() for _ in payloads], payloads)
+        self.assertIsNone(reader.next_payload())
+
+    def test_tags(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "zlib", block_size=100)
+        for i in range(60):
+            tag = b"db%d" % (i % 3)
+            writer.append(b"%s event %d" % (tag, i), b"key %02d" % i, tag)
+        writer.flush()
+
+        reader = NativeEventLogReader(file_path, b"db1")
+        self.assertEqual(reader.read_last_key(), b"key 58")
+        events = iter(reader.next_payload, None)
+        self.assertEqual(list(events), [b"db1 event %d" % i for i in range(1, 60, 3)])
+        writer.append(b"db1 event 61", b"key 61", b"db1")
+        writer.append(b"db2 event 62", b"key 62", b"db2")
+        writer.close()
+        self.assertEqual(reader.next_payload(), b"db1 event 61")
+        self.assertIsNone(reader.next_payload())
+
+        # blocks only have events of one tag
+        index = NativeEventLogReader(file_path).read_index()
+        self.assertEqual({tag for *_, tag in index}, {b"db0", b"db1", b"db2"})
+        self.assertEqual(NativeEventLogReader(file_path, b"db2").read_last_key(), b"key 62")
+        self.assertIsNone(NativeEventLogReader(file_path, b"db3").read_last_key())
+        self.assertEqual(len(list(iter(NativeEventLogReader(file_path).next_payload, None))), 62)
+
+    def test_last_key_of_tag(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "none", block_size=10)
+        writer.append(b"db0 event", b"key 00", b"db0")
+        for i in range(1, 200):
+            tag = b"db1" if i % 2 else b"db2"
+            writer.append(b"%s event %d" % (tag, i), b"key %03d" % i, tag)
+        writer.flush()
+
+        # found from the last block backwards, the first block isn't read
+        with open(file_path, "r+b") as f:
+            f.seek(16)
+            f.write(b"\xff")
+        self.assertEqual(NativeEventLogReader(file_path, b"db1").read_last_key(), b"key 199")
+        self.assertEqual(NativeEventLogReader(file_path, b"db2").read_last_key(), b"key 198")
+        with self.assertRaises(OSError):
+            NativeEventLogReader(file_path, b"db0").read_last_key()
+        writer.close()
+
+    def test_next_event(self):
+        file_path = self.make_file_path()
+        for codec in ("none", "zlib"):
+            writer = NativeEventLogWriter(file_path, codec, block_size=200)
+            events = [(("f", i), "db", "t", [[i, "value %d" % i]], False) for i in range(20)]
+            for event in events:
+                writer.append(cpp_encode_event(*event))
+            writer.close()
+            with open(file_path, "rb") as f:
+                data = f.read()
+
+            # the file is appended to in parts, cut within blocks
+            partial_path = file_path + "." + codec
+            open(partial_path, "wb").close()
+            reader = NativeEventLogReader(partial_path)
+            result = []
+            for start in range(0, len(data), 37):
+                with open(partial_path, "ab") as f:
+                    f.write(data[start:start + 37])
+                result.extend(iter(reader.next_event, None))
+            self.assertEqual(result, events)
+            reader.close()
+
+    def test_corrupted_block(self):
+        file_path = self.make_file_path()
+        writer = NativeEventLogWriter(file_path, "none")
+        writer.append(b"payload")
+        writer.flush()
+        with open(file_path, "r+b") as f:
+            f.seek(-1, os.SEEK_END)
+            f.write(b"X")
+        with self.assertRaises(OSError):
+            NativeEventLogReader(file_path).next_payload()
+        writer.close()
+
+
+class TestClickhouseNative(unittest.TestCase):
+    def test_types(self):
+        for clickhouse_type in ("Int32", "Nullable(String)", "DateTime64(6)", "DateTime64(3, 'UTC')", "Date32"):
+            self.assertTrue(cpp_clickhouse_type_supported(clickhouse_type))
+        for clickhouse_type in ("Decimal(10, 2)", "Nullable(Array(Int32))", "DateTime64(12)"):
+            self.assertFalse(cpp_clickhouse_type_supported(clickhouse_type))
+
+    def test_encode(self):
+        set_local_timezone(self, "UTC0")
+        records = [
+            (1, "abc", 1.5, datetime.date(1970, 1, 2), datetime.datetime(1970, 1, 1, 0, 0, 1, 500000), True),
+            (-2, None, 2, datetime.date(1969, 12, 31), None, False),
+        ]
+        data = cpp_encode_clickhouse_native(
+            records,
+            ["id", "name", "value", "day", "time", "flag"],
+            ["Int16", "Nullable(String)", "Float32", "Date32", "Nullable(DateTime64(3))", "Bool"],
+            41,
+        )
+        expected = b"".join([
+            b"\x07\x02",
+            b"\x02id\x05Int16", struct.pack("<hh", 1, -2),
+            b"\x04name\x10Nullable(String)", b"\x00\x01", b"\x03abc\x00",
+            b"\x05value\x07Float32", struct.pack("<ff", 1.5, 2),
+            b"\x03day\x06Date32", struct.pack("<ii", 1, -1),
+            b"\x04time\x17Nullable(DateTime64(3))", b"\x00\x01", struct.pack("<qq", 1500, 0),
+            b"\x04flag\x04Bool", b"\x01\x00",
+            b"\x08_version\x06UInt64", struct.pack("<QQ", 41, 42),
+        ])
+        self.assertEqual(data, expected)
+
+    def test_naive_datetime_local_time(self):
+        # like clickhouse_connect, which inserts int(value.timestamp()) and
+        # the microseconds, when records go through its fallback path
+        values = [
+            datetime.datetime(2024, 1, 15, 12, 30, 45, 123456),
+            datetime.datetime(2024, 7, 1, 0, 0, 0, 999999),
+            datetime.datetime(2024, 3, 31, 2, 30),  # skipped in Berlin
+            datetime.datetime(2024, 10, 27, 2, 30),  # repeated in Berlin
+            datetime.datetime(2024, 10, 27, 2, 30, fold=1),
+            datetime.datetime(2024, 10, 6, 2, 15),  # Lord Howe goes forward by 30 minutes
+            datetime.datetime(2038, 6, 1, 10, 0),
+        ]
+        for timezone in ("UTC0", "CET-1CEST,M3.5.0,M10.5.0/3", "EST5EDT,M3.2.0,M11.1.0", "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0"):
+            set_local_timezone(self, timezone)
+            data = cpp_encode_clickhouse_native(
+                [(value, value) for value in values], ["time", "seconds"], ["DateTime64(6)", "DateTime"], 1,
+            )
+            expected_ticks = [int(value.timestamp()) * 1000000 + value.microsecond for value in values]
+            expected = b"".join([
+                b"\x03\x07",
+                b"\x04time\x0dDateTime64(6)", struct.pack(f"<{len(values)}q", *expected_ticks),
+                b"\x07seconds\x08DateTime", struct.pack(f"<{len(values)}I", *(int(v.timestamp()) for v in values)),
+                b"\x08_version\x06UInt64", struct.pack(f"<{len(values)}Q", *range(1, len(values) + 1)),
+            ])
+            self.assertEqual(data, expected, timezone)
+            # the same instants as aware datetimes (astimezone() shifts skipped
+            # times the other way than timestamp())
+            aware = [
+                (datetime.datetime.fromtimestamp(value.timestamp(), datetime.timezone.utc),) * 2 for value in values
+            ]
+            self.assertEqual(
+                cpp_encode_clickhouse_native(aware, ["time", "seconds"], ["DateTime64(6)", "DateTime"], 1), data,
+            )
+
+    def test_versions(self):
+        data = cpp_encode_clickhouse_native([(1,), (2,)], ["id"], ["Int8"], struct.pack("<QQ", 7, 3))
+        self.assertEqual(data, b"\x02\x02\x02id\x04Int8\x01\x02\x08_version\x06UInt64" + struct.pack("<QQ", 7, 3))
+        with self.assertRaises(ValueError):
+            cpp_encode_clickhouse_native([(1,), (2,)], ["id"], ["Int8"], struct.pack("<Q", 7))
+
+    def test_errors(self):
+        with self.assertRaises(OverflowError):
+            cpp_encode_clickhouse_native([(128,)], ["id"], ["Int8"], 1)
+        with self.assertRaises(TypeError):
+            cpp_encode_clickhouse_native([(None,)], ["id"], ["Int8"], 1)
+        with self.assertRaises(TypeError):
+            cpp_encode_clickhouse_native([("1",)], ["id"], ["Int8"], 1)
+        with self.assertRaises(ValueError):
+            cpp_encode_clickhouse_native([(1, 2)], ["id"], ["Int8"], 1)
+
+
+class TestNativeStagingTable(unittest.TestCase):
+    def test_apply(self):
+        table = NativeStagingTable()
+        self.assertEqual(table.apply([(1, "a"), (2, "b"), (1, "c")], 0, False, 10), 2)
+        self.assertEqual(table.apply([(2, None), (3, None)], 0, True, 20), 1)
+        self.assertEqual(table.apply([(3, "d"), (4, "e")], 0, False, 30), 1)
+        self.assertEqual((table.insert_count, table.delete_count), (3, 1))
+        self.assertEqual(
+            table.take(),
+            ([(1, "c"), (3, "d"), (4, "e")], struct.pack("<QQQ", 12, 30, 31), [2], struct.pack("<Q", 20)),
+        )
+        self.assertEqual(table.take(), ([], b"", [], b""))
+        self.assertEqual(table.apply([(1, "f")], 0, False, 2 ** 64 - 1), 1)
+        self.assertEqual(table.take()[1], struct.pack("<Q", 2 ** 64 - 1))
+
+    def test_key_types(self):
+        table = NativeStagingTable()
+        keys = [
+            -1, 2 ** 63 - 1, 2 ** 70, "key", "ключ", b"key", decimal.Decimal("1.5"),
+            datetime.date(2024, 1, 1), None,
+        ]
+        self.assertEqual(table.apply([(key, 1) for key in keys], 0, False, 1), len(keys))
+        self.assertEqual(table.apply([(key, 2) for key in keys], 0, False, 1), 0)
+        self.assertEqual(table.take()[0], [(key, 2) for key in keys])
+        with self.assertRaises(TypeError):
+            table.apply([([1], 1)], 0, False, 1)
+        with self.assertRaises(IndexError):
+            table.apply([(1,)], 1, False, 1)
+
+    def test_matches_dict(self):
+        rnd = random.Random(7)
+        table = NativeStagingTable()
+        records_to_insert = {}
+        records_to_delete = {}
+        for event_number in range(2000):
+            is_removal = rnd.random() < 0.3
+            records = [(rnd.randrange(3000), event_number) for _ in range(rnd.randrange(1, 20))]
+            table.apply(records, 0, is_removal, event_number * 100)
+            for index, record in enumerate(records):
+                version = event_number * 100 + index
+                if is_removal:
+                    records_to_delete[record[0]] = version
+                    records_to_insert.pop(record[0], None)
+                else:
+                    records_to_insert[record[0]] = (record, version)
+                    records_to_delete.pop(record[0], None)
+        records, record_versions, keys, key_versions = table.take()
+        record_versions = struct.unpack(f"<{len(records)}Q", record_versions)
+        key_versions = struct.unpack(f"<{len(keys)}Q", key_versions)
+        self.assertEqual(sorted(zip(records, record_versions)), sorted(records_to_insert.values()))
+        self.assertEqual(sorted(zip(keys, key_versions)), sorted(records_to_delete.items()))
+
+
+class TestNativeDirWatcher(unittest.TestCase):
+    def test_wait(self):
+        tmp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(tmp_dir.cleanup)
+        watcher = NativeDirWatcher(tmp_dir.name)
+        self.addCleanup(watcher.close)
+        if os.uname().sysname != "Linux":
+            self.skipTest("polls without inotify")
+        self.assertFalse(watcher.wait(0.01))
+        file_path = os.path.join(tmp_dir.name, "1.bin")
+        with open(file_path, "wb") as f:
+            f.write(b"data")
+        self.assertTrue(watcher.wait(1))
+        self.assertFalse(watcher.wait(0.01))
+        with open(file_path, "ab") as f:
+            f.write(b"more")
+        self.assertTrue(watcher.wait(1))
+
+if __name__ == "__main__":
+    unittest.main()
@@ -6,6 +6,7 @@ import unittest
 from decimal import Decimal
 
 from pymysqlreplication.tests import base
+from pymysqlreplication.bitmap import BitGet
 from pymysqlreplication.constants.BINLOG import *
 from pymysqlreplication.row_event import *
 from pymysqlreplication.event import *
@@ -858,7 +859,7 @@ class TestDataType(base.PyMySQLReplicationTestCase):
             column_type = "INT"
             column_definition.append(column_type)
 
-            nullability = "NOT NULL" if not RowsEvent._is_null(bit_mask, i) else ""
+            nullability = "NOT NULL" if not BitGet(bit_mask, i) else ""
             column_definition.append(nullability)
 
             columns.append(" ".join(column_definition))
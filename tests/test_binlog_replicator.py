@@ -0,0 +1,162 @@
+import os
+import pickle
+import tempfile
+import unittest
+
+from binlog_replicator import (
+    SHARED_LOG_NAME,
+    BinlogReplicator,
+    DataReader,
+    DataWriter,
+    FileRetention,
+    LogEvent,
+    State,
+    get_existing_file_nums,
+    get_file_name_by_num,
+)
+from config import BinlogReplicatorSettings, MysqlSettings
+from pymysqlreplication import BinLogStreamReader
+
+
+class TestBinlogFilesCatchUp(unittest.TestCase):
+    def setUp(self):
+        temp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(temp_dir.cleanup)
+        self.binlog_files_dir = os.path.join(temp_dir.name, 'backup')
+        os.mkdir(self.binlog_files_dir)
+        for file_name in ('mysql-bin.000001', 'mysql-bin.000002'):
+            with open(os.path.join(self.binlog_files_dir, file_name), 'wb') as f:
+                f.write(b'\xfebin')
+        self.settings = BinlogReplicatorSettings(
+            data_dir=os.path.join(temp_dir.name, 'binlog'),
+            binlog_files_dir=self.binlog_files_dir,
+        )
+
+    def restart(self, saved_transaction):
+        if saved_transaction is not None:
+            os.makedirs(self.settings.data_dir, exist_ok=True)
+            state = State(os.path.join(self.settings.data_dir, 'state.json'))
+            state.last_seen_transaction = saved_transaction
+            state.prev_last_seen_transaction = saved_transaction
+            state.save()
+        return BinlogReplicator(MysqlSettings(), self.settings)
+
+    def test_first_run_reads_files(self):
+        replicator = self.restart(None)
+        self.assertIsNotNone(replicator.file_stream)
+        replicator.catch_up_from_files()
+        self.assertEqual(replicator.stream.log_file, 'mysql-bin.000002')
+        self.assertEqual(replicator.stream.log_pos, 4)
+
+    def test_restart_inside_files(self):
+        replicator = self.restart(('mysql-bin.000001', 4))
+        self.assertIsNotNone(replicator.file_stream)
+        replicator.catch_up_from_files()
+        self.assertEqual(replicator.stream.log_file, 'mysql-bin.000002')
+
+    def test_restart_past_files(self):
+        # the live stream went on after the last copied binlog
+        replicator = self.restart(('mysql-bin.000007', 1234))
+        self.assertIsNone(replicator.file_stream)
+        self.assertEqual(replicator.stream.log_file, 'mysql-bin.000007')
+        self.assertEqual(replicator.stream.log_pos, 1234)
+
+
+class TestBinlogStream(unittest.TestCase):
+    def test_native_filter_only_in_replicator(self):
+        stream = BinLogStreamReader(connection_settings={}, server_id=842)
+        self.assertIsNone(stream._BinLogStreamReader__event_filter)
+
+        with tempfile.TemporaryDirectory() as data_dir:
+            replicator = BinlogReplicator(MysqlSettings(), BinlogReplicatorSettings(data_dir=data_dir))
+        self.assertIsNotNone(replicator.stream._BinLogStreamReader__event_filter)
+
+
+class TestDataReader(unittest.TestCase):
+    def setUp(self):
+        temp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(temp_dir.cleanup)
+        self.settings = BinlogReplicatorSettings(
+            data_dir=temp_dir.name, records_per_file=2, compression='zlib', flush_interval=3600,
+        )
+
+    def store(self, data_writer, position):
+        data_writer.store_event(LogEvent(('mysql-bin.000001', position), 'db', 'table', [(position,)]))
+
+    def read_all(self, data_reader):
+        positions = []
+        while True:
+            event = data_reader.read_next_event()
+            if event is None:
+                return positions
+            positions.append(event.transaction_id[1])
+
+    def test_next_file_before_last_block(self):
+        data_writer = DataWriter(self.settings)
+        self.store(data_writer, 1)
+        self.store(data_writer, 2)
+        data_reader = DataReader(self.settings, 'db')
+        self.assertEqual(self.read_all(data_reader), [])
+
+        # the next file shows up before the writer finished the first one
+        next_file_name = get_file_name_by_num(self.settings.data_dir, 'db', 2)
+        open(next_file_name, 'wb').close()
+        self.assertEqual(self.read_all(data_reader), [])
+        os.remove(next_file_name)
+
+        self.store(data_writer, 3)
+        data_writer.flush()
+        self.assertEqual(self.read_all(data_reader), [1, 2, 3])
+
+    def test_file_of_stopped_writer(self):
+        data_writer = DataWriter(self.settings)
+        self.store(data_writer, 1)
+        data_writer.flush()
+        # stops without finishing its file, the next writer starts another
+        file_name = get_file_name_by_num(self.settings.data_dir, 'db', 1)
+        written_size = os.path.getsize(file_name)
+        data_writer.db_file_writers.clear()
+        os.truncate(file_name, written_size)
+        data_writer = DataWriter(self.settings)
+        self.store(data_writer, 2)
+        data_writer.flush()
+
+        data_reader = DataReader(self.settings, 'db')
+        self.assertEqual(self.read_all(data_reader), [1, 2])
+
+
+class TestFileRetention(unittest.TestCase):
+    def setUp(self):
+        temp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(temp_dir.cleanup)
+        self.settings = BinlogReplicatorSettings(
+            data_dir=temp_dir.name, records_per_file=2, compression='zlib', shared_log=True,
+        )
+        self.data_writer = DataWriter(self.settings)
+        # files 1-3 have events of both dbs, file 4 is still written
+        for position in range(1, 8):
+            db_name = 'a' if position % 2 else 'b'
+            self.data_writer.store_event(LogEvent(('mysql-bin.000001', position), db_name, 'table', [(position,)]))
+        self.data_writer.flush()
+
+    def set_processed(self, db_name, position):
+        state_path = os.path.join(self.settings.data_dir, db_name, FileRetention.DB_STATE_FILE_NAME)
+        os.makedirs(os.path.dirname(state_path), exist_ok=True)
+        with open(state_path, 'wb') as f:
+            pickle.dump({'last_processed_transaction': ('mysql-bin.000001', position)}, f)
+
+    def remaining_files(self):
+        FileRetention(self.settings, self.data_writer).run()
+        return get_existing_file_nums(self.settings.data_dir, SHARED_LOG_NAME)
+
+    def test_db_without_state_keeps_files(self):
+        self.set_processed('a', 100)
+        self.assertEqual(self.remaining_files(), [1, 2, 3, 4])
+
+        self.set_processed('b', 5)
+        # file 3 ends with the event of b at 6
+        self.assertEqual(self.remaining_files(), [3, 4])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,27 @@
+import datetime
+import decimal
+import unittest
+
+from clickhouse_api import format_sql_value
+
+
+class TestFormatSqlValue(unittest.TestCase):
+    def test_numbers(self):
+        self.assertEqual(format_sql_value(-12), "-12")
+        self.assertEqual(format_sql_value(True), "1")
+        self.assertEqual(format_sql_value(decimal.Decimal("1.50")), "1.50")
+
+    def test_strings_are_escaped(self):
+        self.assertEqual(format_sql_value("abc"), "'abc'")
+        self.assertEqual(format_sql_value("it's"), "'it\\'s'")
+        self.assertEqual(format_sql_value("a\\' OR 1=1 --"), "'a\\\\\\' OR 1=1 --'")
+
+    def test_bytes(self):
+        self.assertEqual(format_sql_value(b"\x00'\xff"), "unhex('0027ff')")
+
+    def test_dates(self):
+        self.assertEqual(format_sql_value(datetime.date(2024, 1, 2)), "'2024-01-02'")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,198 @@
+import tempfile
+import unittest
+from unittest.mock import patch
+
+from binlog_replicator import LogEvent
+from config import DbReplicatorSettings, Settings
+from db_replicator import DbReplicator, UploadScheduler, transaction_range_token
+from table_structure import TableField, TableStructure
+
+
+MB = 1 << 20
+
+
+def transaction(position):
+    return ('1', position)
+
+
+class TestUploadScheduler(unittest.TestCase):
+    def test_checkpoint_at_oldest_staged_table(self):
+        scheduler = UploadScheduler(DbReplicatorSettings())
+        scheduler.staged('a', 1, 10, transaction(5), transaction(6), 100)
+        scheduler.staged('b', 1, 10, transaction(6), transaction(7), 100)
+        # later records don't move the start of a staged table
+        scheduler.staged('a', 1, 10, transaction(7), transaction(8), 100)
+        self.assertEqual(scheduler.checkpoint(transaction(8)), transaction(5))
+
+        self.assertEqual(scheduler.take('b'), (10, (transaction(6), transaction(7))))
+        self.assertEqual(scheduler.checkpoint(transaction(8)), transaction(5))
+        self.assertEqual(scheduler.take('a'), (20, (transaction(5), transaction(8))))
+        self.assertFalse(scheduler.has_staged())
+        self.assertEqual(scheduler.checkpoint(transaction(8)), transaction(8))
+
+    def test_checkpoint_before_first_event(self):
+        scheduler = UploadScheduler(DbReplicatorSettings())
+        scheduler.staged('a', 1, 10, transaction(3), transaction(4), 100)
+        scheduler.staged('b', 1, 10, None, transaction(5), 100)
+        self.assertIsNone(scheduler.checkpoint(transaction(5)))
+
+    def test_memory_limit_uploads_largest_tables_down_to_half(self):
+        settings = DbReplicatorSettings(staging_memory_limit=1000, upload_part_size=10 * MB)
+        scheduler = UploadScheduler(settings)
+        for position, (table_name, size) in enumerate([('a', 100), ('b', 400), ('c', 200), ('d', 300)]):
+            scheduler.staged(table_name, 1, size, transaction(position), transaction(position + 1), 100)
+
+        self.assertEqual(scheduler.due_tables(None, 100.5, 999), ([], False))
+        # 1000 - 400 - 300 is below half of the limit
+        self.assertEqual(scheduler.due_tables(None, 100.5, 1000), (['b', 'd'], True))
+
+    def test_memory_limit_counts_tables_already_due(self):
+        settings = DbReplicatorSettings(staging_memory_limit=1000, upload_part_rows=2, upload_part_size=10 * MB)
+        scheduler = UploadScheduler(settings)
+        scheduler.staged('a', 1, 300, None, transaction(1), 100)
+        scheduler.staged('b', 2, 200, transaction(1), transaction(2), 100)  # full
+        scheduler.staged('c', 1, 500, transaction(2), transaction(3), 100)
+        self.assertEqual(scheduler.due_tables('b', 100.5, 1000), (['b', 'c'], True))
+
+    def test_due_by_age(self):
+        settings = DbReplicatorSettings(upload_max_delay=10)
+        scheduler = UploadScheduler(settings)
+        scheduler.staged('a', 1, 10, None, transaction(1), 100)
+        self.assertEqual(scheduler.due_tables(None, 105, 10), ([], False))
+        self.assertEqual(scheduler.due_tables(None, 110, 10), (['a'], False))
+
+        # a table taking 8 seconds to upload is due after half of the delay
+        scheduler.take('a')
+        scheduler.uploaded('a', 10, 8)
+        scheduler.staged('a', 1, 10, transaction(1), transaction(2), 200)
+        self.assertEqual(scheduler.due_tables(None, 204, 10), ([], False))
+        self.assertEqual(scheduler.due_tables(None, 205, 10), (['a'], False))
+
+    def test_part_size(self):
+        settings = DbReplicatorSettings(upload_part_size=64 * MB, upload_max_delay=10)
+        scheduler = UploadScheduler(settings)
+        self.assertEqual(scheduler.part_size(scheduler.tables['a']), 64 * MB)
+
+        # uploads at 5 MB/s finish within half of the delay with 25 MB
+        scheduler.uploaded('a', 10 * MB, 2)
+        self.assertEqual(scheduler.part_size(scheduler.tables['a']), 25 * MB)
+
+        # never below MIN_PART_SIZE
+        scheduler.uploaded('b', 100 * 1024, 10)
+        self.assertEqual(scheduler.part_size(scheduler.tables['b']), UploadScheduler.MIN_PART_SIZE)
+
+    def test_is_full(self):
+        settings = DbReplicatorSettings(upload_part_rows=3, upload_part_size=MB)
+        scheduler = UploadScheduler(settings)
+        scheduler.staged('a', 2, 100, None, transaction(1), 100)
+        self.assertFalse(scheduler.is_full(scheduler.tables['a']))
+        scheduler.staged('a', 1, 100, transaction(1), transaction(2), 100)
+        self.assertTrue(scheduler.is_full(scheduler.tables['a']))
+        scheduler.staged('b', 1, MB, None, transaction(3), 100)
+        self.assertTrue(scheduler.is_full(scheduler.tables['b']))
+
+
+class TestTransactionRangeToken(unittest.TestCase):
+    def test_token(self):
+        self.assertEqual(
+            transaction_range_token('db', 't', (('mysql-bin.000001', 5), ('mysql-bin.000002', 7)), 'insert'),
+            'db.t:mysql-bin.000001:5..mysql-bin.000002:7:insert',
+        )
+        self.assertEqual(transaction_range_token('db', 't', (None, ('1', 7)), 'delete'), 'db.t:start..1:7:delete')
+
+
+class RecordingPipeline:
+    def __init__(self):
+        self.batches = []
+
+    def put(self, batch):
+        self.batches.append(batch)
+
+    def pop_acknowledged(self):
+        return None
+
+    def pop_upload_times(self):
+        return []
+
+
+class TestUploadBatches(unittest.TestCase):
+    def setUp(self):
+        tmp_dir = tempfile.TemporaryDirectory()
+        self.addCleanup(tmp_dir.cleanup)
+        self.config = Settings()
+        self.config.binlog_replicator.data_dir = tmp_dir.name
+        self.config.db_replicator.upload_part_rows = 3
+        self.config.db_replicator.upload_max_delay = 3600
+
+        structure = TableStructure(fields=[TableField('id', 'Int32'), TableField('name', 'String')], primary_key='id')
+        structure.preprocess()
+        self.tables_structure = {'a': (structure, structure), 'b': (structure, structure)}
+
+        self.events = []
+        for position in range(1, 40):
+            table_name = 'a' if position % 3 else 'b'
+            records = [(position % 7, f'name {position}')]
+            self.events.append(LogEvent(transaction(position), 'db', table_name, records, position % 5 == 0))
+
+    def make_replicator(self, position):
+        with patch('clickhouse_api.connect'):
+            replicator = DbReplicator(self.config, 'db')
+        replicator.state.tables_structure = self.tables_structure
+        replicator.state.last_processed_transaction_non_uploaded = position
+        replicator.state.save = lambda: None
+        replicator.upload_pipeline = RecordingPipeline()
+        return replicator
+
+    def replay(self, position):
+        replicator = self.make_replicator(position)
+        for event in self.events:
+            replicator.handle_event(event)
+        tokens = []
+        for batch in replicator.upload_pipeline.batches:
+            for table_name, transaction_range in sorted(batch.table_ranges.items()):
+                tokens.append(transaction_range_token('db', table_name, transaction_range, 'insert'))
+        return replicator.upload_pipeline.batches, tokens
+
+    def test_batches(self):
+        batches, tokens = self.replay(None)
+        self.assertTrue(tokens)
+        position = None
+        for batch in batches:
+            for table_name, (first, last) in batch.table_ranges.items():
+                self.assertLess(first or transaction(0), last)
+                records, versions = batch.records_to_insert.get(table_name, ([], b''))
+                keys, key_versions = batch.records_to_delete.get(table_name, ([], b''))
+                self.assertTrue(records or keys)
+                self.assertEqual(len(versions), 8 * len(records))
+                self.assertEqual(len(key_versions), 8 * len(keys))
+            # the position never goes back
+            self.assertLessEqual(position or transaction(0), batch.transaction_id or transaction(0))
+            position = batch.transaction_id
+
+    def test_replay_gives_the_same_tokens(self):
+        batches, tokens = self.replay(None)
+        self.assertEqual(self.replay(None)[1], tokens)
+
+        # after a restart from the position of a batch, the table that held
+        # the position back stages the same range again. The other tables
+        # start at the position too, their next ranges differ from before
+        # (the records repeated have the same _version).
+        for batch_number, batch in enumerate(batches):
+            if batch.transaction_id is None:
+                continue
+            replayed_batches, _ = self.replay(batch.transaction_id)
+            for table_name in ('a', 'b'):
+                ranges = [
+                    later_batch.table_ranges[table_name] for later_batch in batches[batch_number + 1:]
+                    if table_name in later_batch.table_ranges
+                ]
+                if not ranges or ranges[0][0] != batch.transaction_id:
+                    continue
+                replayed_ranges = [
+                    replayed_batch.table_ranges[table_name] for replayed_batch in replayed_batches
+                    if table_name in replayed_batch.table_ranges
+                ]
+                self.assertEqual(replayed_ranges[0], ranges[0])
+
+if __name__ == '__main__':
+    unittest.main()